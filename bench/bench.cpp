@@ -0,0 +1,435 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "const_fold.hpp"
+#include "driver.hpp"
+#include "encoder.hpp"
+#include "error.hpp"
+#include "generation.hpp"
+#include "ir_builder.hpp"
+#include "parser.hpp"
+#include "passes.hpp"
+#include "peephole.hpp"
+#include "thread_pool.hpp"
+#include "tokenization.hpp"
+#include "workload.hpp"
+
+// bumped whenever a field of the JSON report changes meaning
+static constexpr int k_schema = 1;
+
+namespace stage {
+enum : uint8_t {
+    tokenize,       // Tokenizer::tokenize
+    parse,          // Parser::parse_prog
+    lower,          // AST to IR, with the -O passes
+    generate,       // IR to machine code: selection, registers, peephole, encoding
+    count,
+};
+}
+
+static constexpr const char* k_stage_names[stage::count] = {"tokenize", "parse", "lower", "generate"};
+
+struct Options{
+    double size_mb = 4;
+    int reps = 3;
+    uint64_t seed = 1;
+    int opt_level = 0;
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());     // 0: no scaling run
+    size_t files = 64;
+};
+
+// What a child process sends back: sizes once, times the best of the reps.
+struct Result{
+    uint64_t bytes = 0;
+    uint64_t tokens = 0;
+    uint64_t nodes = 0;
+    uint64_t ir_insts = 0;
+    uint64_t code_bytes = 0;
+    uint64_t token_bytes = 0;       // of the token vector
+    uint64_t ast_bytes = 0;
+    double seconds[stage::count] = {};
+};
+
+static void usage(){
+    std::cerr << "incorrect usage\n";
+    std::cerr << "atom_bench [--size <MB>] [--reps <n>] [--seed <n>] [-O] [--jobs <n>] [--files <n>] [--json <file>] [workload...]\n";
+    std::cerr << "atom_bench --generate <workload> [--size <MB>] [--seed <n>]\n";
+    std::cerr << "workloads:\n";
+    for (const WorkloadInfo& info : workloads()){
+        std::cerr << "  " << std::left << std::setw(10) << info.name << info.description << "\n";
+    }
+}
+
+template <typename F>
+static double seconds(F&& stage){
+    const auto start = std::chrono::steady_clock::now();
+    stage();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Compiles source reps times, reusing the buffers the way a compile server
+// does, and keeps the fastest time of each stage.
+static Result measure(std::string_view source, const Options& options){
+    Result result;
+    result.bytes = source.size();
+    std::fill(std::begin(result.seconds), std::end(result.seconds), 1e300);
+
+    Interner interner;
+    Ast ast;
+    std::vector<Token> tokens;
+    PassManager passes;
+    add_passes(passes, options.opt_level);
+    Peephole peephole;
+    for (int rep = 0; rep < options.reps; ++rep){
+        interner.clear();
+        ast.clear();
+        tokens.clear();
+        double took[stage::count];
+
+        Tokenizer tokenizer(source, interner);
+        took[stage::tokenize] = seconds([&]{ tokenizer.tokenize(tokens); });
+
+        Parser parser(std::move(tokens), ast);
+        std::optional<nodeProg> prog;
+        took[stage::parse] = seconds([&]{ prog = parser.parse_prog(); });
+        if (!prog) throw CompileError("invalid program");
+        tokens = parser.release_tokens();
+
+        IrFunction fn;
+        took[stage::lower] = seconds([&]{
+            if (options.opt_level > 0) prog = ConstFolder(ast, interner).fold_prog(prog.value());
+            IrBuilder(ast, interner).build_prog(prog.value(), fn);
+            passes.run(fn);
+        });
+
+        Encoder encoder;
+        took[stage::generate] = seconds([&]{
+            Generator generator(&peephole);
+            generator.begin_prog();
+            generator.gen_function(fn);
+            generator.end_prog();
+            generator.optimize();
+            generator.flush(encoder);
+        });
+
+        for (int i = 0; i < stage::count; ++i){
+            result.seconds[i] = std::min(result.seconds[i], took[i]);
+        }
+        result.tokens = tokens.size();
+        result.token_bytes = tokens.capacity() * sizeof(Token);
+        result.nodes = ast.node_count();
+        result.ast_bytes = ast.bytes();
+        result.ir_insts = fn.inst_count();
+        result.code_bytes = encoder.size();
+    }
+    return result;
+}
+
+// Generates and measures one workload in a child process, so that its peak
+// memory is its own. False if the child failed.
+static bool run_child(Workload kind, const Options& options, Result& result, long& peak_rss_kb){
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::cerr << "pipe: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork: " << std::strerror(errno) << "\n";
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int status = EXIT_SUCCESS;
+        try {
+            const std::string source = generate(kind, static_cast<size_t>(options.size_mb * 1e6), options.seed);
+            const Result measured = measure(source, options);
+            if (write(fds[1], &measured, sizeof(measured)) != static_cast<ssize_t>(sizeof(measured))) status = EXIT_FAILURE;
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            status = EXIT_FAILURE;
+        }
+        _exit(status);
+    }
+    close(fds[1]);
+    size_t got = 0;
+    while (got < sizeof(result)) {
+        const ssize_t n = read(fds[0], reinterpret_cast<char*>(&result) + got, sizeof(result) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += static_cast<size_t>(n);
+    }
+    close(fds[0]);
+    int status = 0;
+    rusage usage{};
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) return false;
+    }
+    peak_rss_kb = usage.ru_maxrss;
+    return got == sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+struct Row{
+    std::string_view name;
+    Result result;
+    long peak_rss_kb;
+};
+
+// one thread count of the scaling run
+struct ScalingRow{
+    size_t threads;
+    double seconds;
+};
+
+struct Scaling{
+    uint64_t bytes = 0;         // of all the files together
+    std::vector<ScalingRow> rows;
+};
+
+// The thread counts to try: 1, 2, 4, ... and jobs itself.
+static std::vector<size_t> thread_counts(size_t jobs){
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < jobs; threads *= 2) counts.push_back(threads);
+    counts.push_back(jobs);
+    return counts;
+}
+
+// Compiles a batch of files the way atom -j does: one CompileContext per
+// worker of a ThreadPool, an executable per file. The files take turns
+// among the workloads and share --size between them. Throws CompileError
+// if a file fails to compile.
+static Scaling measure_scaling(const std::vector<Workload>& kinds, const Options& options){
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / ("atom_bench." + std::to_string(getpid()));
+    fs::create_directories(dir);
+    struct Cleanup{
+        const fs::path& dir;
+        ~Cleanup(){
+            std::error_code ec;
+            fs::remove_all(dir, ec);
+        }
+    } cleanup{dir};
+
+    Scaling scaling;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    const size_t bytes = std::max<size_t>(static_cast<size_t>(options.size_mb * 1e6) / options.files, 1024);
+    for (size_t i = 0; i < options.files; ++i){
+        const std::string source = generate(kinds[i % kinds.size()], bytes, options.seed + i);
+        outputs.push_back((dir / std::string("f").append(std::to_string(i))).string());
+        inputs.push_back(outputs.back() + ".at");
+        std::ofstream(inputs.back()) << source;
+        scaling.bytes += source.size();
+    }
+
+    CompileOptions compile;
+    compile.opt_level = options.opt_level;
+    for (const size_t threads : thread_counts(options.jobs)){
+        ThreadPool pool(threads);
+        std::vector<CompileContext> contexts(pool.size());
+        std::vector<std::string> errors(inputs.size());
+        double best = 1e300;
+        for (int rep = 0; rep < options.reps; ++rep){
+            best = std::min(best, seconds([&]{
+                pool.run(inputs.size(), [&](size_t task, size_t worker) {
+                    try {
+                        compile_file(inputs[task], outputs[task], compile, contexts[worker]);
+                    } catch (const std::exception& err) {
+                        errors[task] = err.what();
+                    }
+                });
+            }));
+        }
+        for (size_t i = 0; i < errors.size(); ++i){
+            if (!errors[i].empty()) throw CompileError(inputs[i] + ": " + errors[i]);
+        }
+        scaling.rows.push_back({threads, best});
+    }
+    return scaling;
+}
+
+static void write_rate(std::ostream& out, const char* name, uint64_t count, double seconds){
+    out << "\"" << name << "\": " << static_cast<double>(count) / std::max(seconds, 1e-9);
+}
+
+static void write_json(std::ostream& out, const Options& options, long baseline_rss_kb, const std::vector<Row>& rows,
+                       const Scaling& scaling){
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"schema\": " << k_schema << ",\n";
+    out << "  \"timestamp\": " << static_cast<long long>(std::time(nullptr)) << ",\n";
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    out << "  \"size_mb\": " << options.size_mb << ",\n";
+    out << "  \"reps\": " << options.reps << ",\n";
+    out << "  \"seed\": " << options.seed << ",\n";
+    out << "  \"opt_level\": " << options.opt_level << ",\n";
+    out << "  \"baseline_rss_kb\": " << baseline_rss_kb << ",\n";
+    out << "  \"workloads\": [";
+    for (size_t i = 0; i < rows.size(); ++i){
+        const Result& r = rows[i].result;
+        out << (i ? "," : "") << "\n    {\n";
+        out << "      \"name\": \"" << rows[i].name << "\",\n";
+        out << "      \"bytes\": " << r.bytes << ",\n";
+        out << "      \"tokens\": " << r.tokens << ",\n";
+        out << "      \"nodes\": " << r.nodes << ",\n";
+        out << "      \"ir_insts\": " << r.ir_insts << ",\n";
+        out << "      \"code_bytes\": " << r.code_bytes << ",\n";
+        out << "      \"token_bytes\": " << r.token_bytes << ",\n";
+        out << "      \"ast_bytes\": " << r.ast_bytes << ",\n";
+        out << "      \"peak_rss_kb\": " << rows[i].peak_rss_kb << ",\n";
+        out << "      \"stages\": {";
+        double total = 0;
+        for (int i = 0; i <= stage::count; ++i){
+            const double s = i < stage::count ? r.seconds[i] : total;
+            total += i < stage::count ? s : 0;
+            out << (i ? "," : "") << "\n        \"" << (i < stage::count ? k_stage_names[i] : "total")
+                << "\": {\"seconds\": " << s << ", ";
+            out << "\"mb_per_s\": " << static_cast<double>(r.bytes) / 1e6 / std::max(s, 1e-9) << ", ";
+            write_rate(out, "tokens_per_s", r.tokens, s);
+            out << ", ";
+            write_rate(out, "nodes_per_s", r.nodes, s);
+            out << "}";
+        }
+        out << "\n      }\n    }";
+    }
+    out << "\n  ],\n";
+    out << "  \"scaling\": {\"files\": " << options.files << ", \"bytes\": " << scaling.bytes << ", \"runs\": [";
+    for (size_t i = 0; i < scaling.rows.size(); ++i){
+        const ScalingRow& row = scaling.rows[i];
+        out << (i ? "," : "") << "\n    {\"threads\": " << row.threads << ", \"seconds\": " << row.seconds << ", ";
+        write_rate(out, "files_per_s", options.files, row.seconds);
+        out << ", \"mb_per_s\": " << static_cast<double>(scaling.bytes) / 1e6 / std::max(row.seconds, 1e-9)
+            << ", \"speedup\": " << scaling.rows.front().seconds / std::max(row.seconds, 1e-9) << "}";
+    }
+    out << (scaling.rows.empty() ? "]}\n}\n" : "\n  ]}\n}\n");
+}
+
+// the same in MB/s, for a person reading along
+static void write_table(std::ostream& out, const std::vector<Row>& rows){
+    out << std::left << std::setw(10) << "workload" << std::right << std::setw(10) << "MB";
+    for (const char* name : k_stage_names) out << std::setw(12) << name;
+    out << std::setw(12) << "peak MB" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (const Row& row : rows){
+        out << std::left << std::setw(10) << row.name << std::right
+            << std::setw(10) << static_cast<double>(row.result.bytes) / 1e6;
+        for (const double s : row.result.seconds){
+            out << std::setw(12) << static_cast<double>(row.result.bytes) / 1e6 / std::max(s, 1e-9);
+        }
+        out << std::setw(12) << static_cast<double>(row.peak_rss_kb) / 1e3 << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+static void write_scaling_table(std::ostream& out, const Options& options, const Scaling& scaling){
+    if (scaling.rows.empty()) return;
+    out << "\n" << std::left << std::setw(10) << "threads" << std::right << std::setw(10) << "files"
+        << std::setw(12) << "ms" << std::setw(12) << "files/s" << std::setw(12) << "speedup" << "\n";
+    out << std::fixed << std::setprecision(1);
+    for (const ScalingRow& row : scaling.rows){
+        out << std::left << std::setw(10) << row.threads << std::right << std::setw(10) << options.files
+            << std::setw(12) << row.seconds * 1e3 << std::setw(12) << static_cast<double>(options.files) / row.seconds
+            << std::setw(12) << std::setprecision(2) << scaling.rows.front().seconds / row.seconds << std::setprecision(1) << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::optional<std::string> json_path;
+    std::optional<Workload> to_generate;
+    std::vector<Workload> selected;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) options.size_mb = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--reps") == 0 && i + 1 < argc) options.reps = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "-O") == 0 || std::strcmp(argv[i], "-O1") == 0) options.opt_level = 1;
+        else if (std::strcmp(argv[i], "-O0") == 0) options.opt_level = 0;
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) options.jobs = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--files") == 0 && i + 1 < argc) options.files = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--generate") == 0 && i + 1 < argc) {
+            to_generate = find_workload(argv[++i]);
+            if (!to_generate) {
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+        else if (const std::optional<Workload> kind = find_workload(argv[i])) selected.push_back(kind.value());
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.size_mb <= 0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (to_generate) {
+        std::cout << generate(to_generate.value(), static_cast<size_t>(options.size_mb * 1e6), options.seed);
+        return std::cout.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (selected.empty()) {
+        for (const WorkloadInfo& info : workloads()) selected.push_back(info.kind);
+    }
+
+    rusage self{};
+    getrusage(RUSAGE_SELF, &self);
+    // flushed now, or the children would write it out again
+    std::cout.flush();
+    std::cerr.flush();
+
+    std::vector<Row> rows;
+    bool failed = false;
+    for (const Workload kind : selected){
+        Row row{workloads()[static_cast<size_t>(kind)].name, {}, 0};
+        if (!run_child(kind, options, row.result, row.peak_rss_kb)) {
+            std::cerr << "atom_bench: workload " << row.name << " failed\n";
+            failed = true;
+            continue;
+        }
+        rows.push_back(row);
+    }
+
+    // after the children, which must not be forked with pool threads around
+    Scaling scaling;
+    if (options.jobs > 0) {
+        try {
+            scaling = measure_scaling(selected, options);
+        } catch (const std::exception& err) {
+            std::cerr << "atom_bench: scaling run failed: " << err.what() << "\n";
+            failed = true;
+        }
+    }
+
+    write_table(std::cerr, rows);
+    write_scaling_table(std::cerr, options, scaling);
+    if (json_path) {
+        std::ofstream file(json_path.value());
+        write_json(file, options, self.ru_maxrss, rows, scaling);
+        if (!file) {
+            std::cerr << "atom_bench: cannot write " << json_path.value() << "\n";
+            return EXIT_FAILURE;
+        }
+    } else {
+        write_json(std::cout, options, self.ru_maxrss, rows, scaling);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,244 @@
+#include "workload.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+
+static constexpr std::array k_workloads{
+    WorkloadInfo{Workload::lets, "lets", "lets using earlier variables"},
+    WorkloadInfo{Workload::scopes, "scopes", "blocks nested 48 deep"},
+    WorkloadInfo{Workload::ifchain, "ifchain", "if/elif/else chains of 32 arms"},
+    WorkloadInfo{Workload::expr, "expr", "balanced expressions of 1024 operands"},
+    WorkloadInfo{Workload::comments, "comments", "line and block comments around lets"},
+};
+
+static constexpr int k_scope_depth = 48;
+static constexpr int k_chain_arms = 32;
+static constexpr int k_expr_depth = 10;
+
+static constexpr std::array<std::string_view, 24> k_words{
+    "the", "value", "of", "each", "counter", "is", "kept", "in", "a", "register", "until", "it",
+    "spills", "and", "then", "reloaded", "before", "use", "so", "that", "later", "reads", "see", "it",
+};
+
+std::span<const WorkloadInfo> workloads(){
+    return k_workloads;
+}
+
+std::optional<Workload> find_workload(std::string_view name){
+    for (const WorkloadInfo& info : k_workloads){
+        if (info.name == name) return info.kind;
+    }
+    return {};
+}
+
+namespace {
+
+// splitmix64: small, fast and the same everywhere
+class Rng{
+public:
+    explicit Rng(uint64_t seed) : m_state(seed) {}
+
+    uint64_t next(){
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // in [0, n), n > 0
+    uint64_t below(uint64_t n){
+        return next() % n;
+    }
+private:
+    uint64_t m_state;
+};
+
+class Program{
+public:
+    Program(size_t bytes, uint64_t seed) : m_bytes(bytes), m_rng(seed) {
+        m_text.reserve(bytes + 4096);
+    }
+
+    bool full() const {
+        return m_text.size() >= m_bytes;
+    }
+
+    Program& operator<<(std::string_view text){
+        m_text += text;
+        return *this;
+    }
+
+    Program& operator<<(uint64_t value){
+        char digits[20];
+        m_text.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+        return *this;
+    }
+
+    void indent(int depth){
+        m_text.append(2 * static_cast<size_t>(depth), ' ');
+    }
+
+    Rng& rng(){
+        return m_rng;
+    }
+
+    std::string take(){
+        return std::move(m_text);
+    }
+private:
+    size_t m_bytes;
+    Rng m_rng;
+    std::string m_text;
+};
+
+}
+
+static void gen_lets(Program& out){
+    Rng& rng = out.rng();
+    out << "let v0 = 1;\n";
+    uint64_t count = 1;
+    // mostly one of the last few variables, now and then any earlier one
+    const auto pick = [&] {
+        const uint64_t span = rng.below(4) ? std::min<uint64_t>(count, 8) : count;
+        return count - 1 - rng.below(span);
+    };
+    while (!out.full()) {
+        out << "let v" << count << " = ";
+        switch (rng.below(4)) {
+            case 0:
+                out << "v" << pick() << " + " << rng.below(100);
+                break;
+            case 1:
+                out << "v" << pick() << " * v" << pick() << " - " << rng.below(100);
+                break;
+            case 2:
+                out << "(v" << pick() << " + " << rng.below(100) << ") == v" << pick();
+                break;
+            default:
+                out << "v" << pick() << " - v" << pick() << " * (v" << pick() << " + " << rng.below(100) << ")";
+                break;
+        }
+        out << ";\n";
+        ++count;
+    }
+    out << "exit(v" << count - 1 << ");\n";
+}
+
+// Names cannot be shadowed, so every block declares its own.
+static void gen_scopes(Program& out){
+    Rng& rng = out.rng();
+    out << "let acc = 0;\n";
+    for (uint64_t block = 0; !out.full(); ++block){
+        for (int depth = 0; depth < k_scope_depth; ++depth){
+            out.indent(depth);
+            out << "{\n";
+            out.indent(depth + 1);
+            out << "let s" << block << "d" << static_cast<uint64_t>(depth) << " = ";
+            if (depth == 0) out << "acc";
+            else out << "s" << block << "d" << static_cast<uint64_t>(depth - 1);
+            out << " + " << rng.below(100) << ";\n";
+        }
+        for (int depth = k_scope_depth - 1; depth >= 0; --depth){
+            out.indent(depth + 1);
+            out << "acc = acc * 3 + s" << block << "d" << static_cast<uint64_t>(depth) << ";\n";
+            out.indent(depth);
+            out << "}\n";
+        }
+    }
+    out << "exit(acc);\n";
+}
+
+static void gen_ifchain(Program& out){
+    Rng& rng = out.rng();
+    out << "let x = 0;\nlet acc = 1;\n";
+    while (!out.full()) {
+        const uint64_t first = rng.below(k_chain_arms);
+        for (int arm = 0; arm < k_chain_arms; ++arm){
+            out << (arm == 0 ? "if (x == " : "} elif (x == ") << first + static_cast<uint64_t>(arm) << ") {\n    ";
+            switch (rng.below(3)) {
+                case 0: out << "acc = acc + " << rng.below(100) << ";\n"; break;
+                case 1: out << "acc = acc * " << rng.below(100) << ";\n"; break;
+                default: out << "acc = acc - x;\n"; break;
+            }
+        }
+        out << "} else {\n    acc = acc - 1;\n}\nx = x + 1;\n";
+    }
+    out << "exit(acc);\n";
+}
+
+static void gen_tree(Program& out, int depth, uint64_t exprs){
+    Rng& rng = out.rng();
+    if (depth == 0) {
+        switch (rng.below(3)) {
+            case 0: out << rng.below(1000); break;
+            case 1: out << "x"; break;
+            default:
+                if (exprs) out << "e" << exprs - 1 - rng.below(std::min<uint64_t>(exprs, 4));
+                else out << rng.below(1000);
+                break;
+        }
+        return;
+    }
+    static constexpr std::string_view ops[] = {" + ", " - ", " * "};
+    out << "(";
+    gen_tree(out, depth - 1, exprs);
+    out << ops[rng.below(3)];
+    gen_tree(out, depth - 1, exprs);
+    out << ")";
+}
+
+static void gen_expr(Program& out){
+    out << "let x = 7;\n";
+    uint64_t count = 0;
+    while (!out.full()) {
+        out << "let e" << count << " = ";
+        gen_tree(out, k_expr_depth, count);
+        out << ";\n";
+        ++count;
+    }
+    out << "exit(" << (count ? "e" : "x");
+    if (count) out << count - 1;
+    out << ");\n";
+}
+
+static void sentence(Program& out, int words){
+    for (int i = 0; i < words; ++i){
+        out << (i ? " " : "") << k_words[out.rng().below(k_words.size())];
+    }
+}
+
+static void gen_comments(Program& out){
+    Rng& rng = out.rng();
+    out << "let c0 = 0;\n";
+    uint64_t count = 1;
+    while (!out.full()) {
+        if (count % 4 == 0) {
+            out << "/*\n";
+            for (int line = 0; line < 4; ++line){
+                out << " * ";
+                sentence(out, 10);
+                out << "\n";
+            }
+            out << " */\n";
+        }
+        out << "// ";
+        sentence(out, 12);
+        out << "\nlet c" << count << " = c" << count - 1 << " + " << rng.below(100) << "; // ";
+        sentence(out, 4);
+        out << "\n";
+        ++count;
+    }
+    out << "exit(c" << count - 1 << ");\n";
+}
+
+std::string generate(Workload kind, size_t bytes, uint64_t seed){
+    Program out(bytes, seed);
+    switch (kind) {
+        case Workload::lets: gen_lets(out); break;
+        case Workload::scopes: gen_scopes(out); break;
+        case Workload::ifchain: gen_ifchain(out); break;
+        case Workload::expr: gen_expr(out); break;
+        case Workload::comments: gen_comments(out); break;
+    }
+    return out.take();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Synthetic Atom programs for the throughput bench. Each kind stresses one
+// part of the compiler and grows to any size; the same kind, size and seed
+// always give the same program, which compiles and runs.
+enum class Workload : uint8_t {
+    lets,           // a long run of lets, each using earlier variables
+    scopes,         // blocks nested deep, declaring and assigning on the way
+    ifchain,        // long if/elif/else chains
+    expr,           // huge balanced arithmetic expressions
+    comments,       // mostly line and block comments around a few lets
+};
+
+struct WorkloadInfo{
+    Workload kind;
+    std::string_view name;
+    std::string_view description;
+};
+
+std::span<const WorkloadInfo> workloads();
+
+std::optional<Workload> find_workload(std::string_view name);
+
+// A program of about bytes bytes (a statement more at most), ending in exit.
+std::string generate(Workload kind, size_t bytes, uint64_t seed);
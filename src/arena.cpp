@@ -1,8 +0,0 @@
-#include "arena.hpp"
-#include <cstdlib>
-
-ArenaAllocator::ArenaAllocator(size_t bytes) : m_size(bytes), m_buffer(static_cast<std::byte*>(malloc(bytes))), m_offset(m_buffer) {}
-
-ArenaAllocator::~ArenaAllocator(){
-    free(m_buffer);
-}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "interner.hpp"
+
+// The syntax tree is stored flat: every node kind lives in its own
+// contiguous array and nodes refer to each other by 32-bit index.
+
+using NodeId = uint32_t;
+
+inline constexpr NodeId k_no_node = UINT32_MAX;
+
+enum class ExprKind : uint8_t {
+    int_lit,
+    ident,
+    add,
+    sub,
+    multi,
+    div,
+    eq,
+};
+
+struct nodeExpr{
+    ExprKind kind;
+    union {
+        NodeId lhs;      // binary operators
+        uint32_t lit;    // int_lit: index into Ast::ints
+        SymbolId ident;  // ident
+    };
+    NodeId rhs;          // binary operators
+};
+
+// [first, first + count) in Ast::stmt_lists
+struct StmtRange{
+    uint32_t first;
+    uint32_t count;
+};
+
+enum class StmtKind : uint8_t {
+    exit,
+    let,
+    assign,
+    scope,
+    if_,
+};
+
+struct nodeStmt{
+    StmtKind kind;
+    union {
+        SymbolId ident;  // let, assign
+        NodeId pred;     // if: first elif/else in Ast::preds, or k_no_node
+    };
+    NodeId expr;         // exit, let, assign, if condition
+    StmtRange scope;     // scope, if body
+};
+
+enum class PredKind : uint8_t {
+    elif,
+    else_,
+};
+
+struct nodeIfPred{
+    PredKind kind;
+    NodeId expr;         // elif condition
+    StmtRange scope;
+    NodeId next;         // elif: following elif/else, or k_no_node
+};
+
+struct nodeProg{
+    StmtRange stmts;
+};
+
+inline bool is_bin_expr(ExprKind kind){
+    return kind >= ExprKind::add;
+}
+
+struct Ast{
+    std::vector<nodeExpr> exprs;
+    std::vector<uint64_t> ints;
+    std::vector<nodeStmt> stmts;
+    std::vector<nodeIfPred> preds;
+    std::vector<NodeId> stmt_lists;
+
+    const nodeExpr& expr(NodeId id) const {
+        return exprs[id];
+    }
+
+    const nodeStmt& stmt(NodeId id) const {
+        return stmts[id];
+    }
+
+    const nodeIfPred& pred(NodeId id) const {
+        return preds[id];
+    }
+
+    uint64_t int_value(const nodeExpr& expr) const {
+        return ints[expr.lit];
+    }
+
+    std::span<const NodeId> list(StmtRange range) const {
+        return {stmt_lists.data() + range.first, range.count};
+    }
+
+    size_t node_count() const {
+        return exprs.size() + stmts.size() + preds.size();
+    }
+
+    size_t bytes() const {
+        return exprs.size() * sizeof(nodeExpr) + ints.size() * sizeof(uint64_t)
+            + stmts.size() * sizeof(nodeStmt) + preds.size() * sizeof(nodeIfPred)
+            + stmt_lists.size() * sizeof(NodeId);
+    }
+
+    // what the pools have allocated, in use or not
+    size_t reserved_bytes() const {
+        return exprs.capacity() * sizeof(nodeExpr) + ints.capacity() * sizeof(uint64_t)
+            + stmts.capacity() * sizeof(nodeStmt) + preds.capacity() * sizeof(nodeIfPred)
+            + stmt_lists.capacity() * sizeof(NodeId);
+    }
+
+    // Drops all nodes but keeps the allocated storage.
+    void clear(){
+        exprs.clear();
+        ints.clear();
+        stmts.clear();
+        preds.clear();
+        stmt_lists.clear();
+    }
+};
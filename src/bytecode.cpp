@@ -0,0 +1,344 @@
+#include "bytecode.hpp"
+#include "error.hpp"
+#include "output.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <queue>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// file layout: the header, the constants, then the instructions
+struct BcHeader{
+    char magic[4];
+    uint32_t version;
+    uint32_t registers;
+    uint32_t constant_count;
+    uint64_t inst_count;
+};
+
+static constexpr char k_magic[4] = {'A', 'T', 'B', 'C'};
+static constexpr uint32_t k_version = 1;
+
+// which fields of an instruction name registers
+static bool reads_a(BcOp op){
+    return op != BcOp::jmp;
+}
+
+static bool reads_b(BcOp op){
+    return (op >= BcOp::add && op <= BcOp::eq) || op == BcOp::jeq || op == BcOp::jne;
+}
+
+static bool writes_dst(BcOp op){
+    return op <= BcOp::eq;
+}
+
+static bool is_jump(BcOp op){
+    return op >= BcOp::jmp && op <= BcOp::jne;
+}
+
+// Same scheme as Generator::allocate: instruction i uses its operands at
+// 2i and defines its result at 2i + 1, phis are defined at the top of their
+// block and their arguments are used at the end of each predecessor.
+void BytecodeBuilder::allocate(const IrFunction& fn){
+    const size_t count = fn.vreg_count;
+    m_operand.assign(count, 0);
+    m_fused.assign(count, 0);
+    std::vector<uint8_t> is_const(count, 0);
+    std::vector<uint32_t> start(count, UINT32_MAX);
+    std::vector<uint32_t> end(count, 0);
+    std::vector<uint32_t> uses(count, 0);
+    std::vector<uint32_t> block_end(fn.blocks.size(), 0);
+    std::vector<VReg> conditions;
+    const auto use = [&](VReg v, uint32_t pos){
+        end[v] = std::max(end[v], pos);
+        uses[v]++;
+    };
+
+    uint32_t index = 0;
+    for (BlockId id = 0; id < fn.blocks.size(); ++id){
+        const IrBlock& block = fn.blocks[id];
+        if (block.dead) continue;
+        const uint32_t first = index;
+        uint32_t last_phi = first;
+        while (last_phi - first < block.insts.size() && block.insts[last_phi - first].op == IrOp::phi) ++last_phi;
+        const IrInst* last = nullptr;     // that generates code
+        for (const IrInst& inst : block.insts){
+            const uint32_t pos = 2 * index++;
+            if (inst.op == IrOp::branch && last && last->op == IrOp::eq && last->dst == inst.a) conditions.push_back(inst.a);
+            if (inst.op != IrOp::const_) last = &inst;
+            switch (inst.op){
+                case IrOp::const_:
+                    is_const[inst.dst] = 1;
+                    m_operand[inst.dst] = constant(inst.imm);
+                    continue;
+                case IrOp::phi: {
+                    start[inst.dst] = 2 * first + 1;
+                    use(inst.dst, 2 * last_phi + 1);
+                    const std::span<const VReg> args = fn.args(inst);
+                    for (size_t k = 0; k < args.size(); ++k) use(args[k], 2 * block_end[block.preds[k]]);
+                    continue;
+                }
+                case IrOp::store:
+                case IrOp::exit:
+                case IrOp::branch:
+                    use(inst.a, pos);
+                    break;
+                default:
+                    if (is_binary(inst.op)) {
+                        use(inst.a, pos);
+                        use(inst.b, pos);
+                    }
+                    break;
+            }
+            if (inst.dst != k_no_vreg) start[inst.dst] = pos + 1;
+        }
+        block_end[id] = index - 1;
+    }
+    for (const VReg v : conditions){
+        if (uses[v] == 1) m_fused[v] = 1;
+    }
+
+    std::vector<std::pair<uint32_t, VReg>> intervals;   // (start, vreg)
+    for (VReg v = 0; v < count; ++v){
+        if (start[v] == UINT32_MAX || is_const[v] || m_fused[v]) continue;
+        end[v] = std::max(start[v], end[v]);
+        intervals.emplace_back(start[v], v);
+    }
+    std::sort(intervals.begin(), intervals.end());
+
+    // a temporary is free again once the interval holding it has ended
+    using Busy = std::pair<uint32_t, uint32_t>;    // (end, temporary)
+    std::priority_queue<Busy, std::vector<Busy>, std::greater<Busy>> busy;
+    std::vector<uint32_t> free_temps;
+    uint32_t temps = 1;
+    for (const auto& [from, v] : intervals){
+        while (!busy.empty() && busy.top().first < from){
+            free_temps.push_back(busy.top().second);
+            busy.pop();
+        }
+        uint32_t temp = temps;
+        if (free_temps.empty()) {
+            ++temps;
+        } else {
+            temp = free_temps.back();
+            free_temps.pop_back();
+        }
+        m_operand[v] = k_temp | temp;
+        busy.emplace(end[v], temp);
+    }
+    if (temps > k_index_mask) {
+        throw CompileError("program too large for bytecode");
+    }
+    m_temps = std::max(m_temps, temps);
+}
+
+uint32_t BytecodeBuilder::operand(VReg vreg) const {
+    return m_operand[vreg];
+}
+
+uint32_t BytecodeBuilder::constant(uint64_t value){
+    const auto [it, added] = m_constant_index.try_emplace(value, static_cast<uint32_t>(m_constants.size()));
+    if (added) m_constants.push_back(value);
+    return k_const | it->second;
+}
+
+void BytecodeBuilder::emit_jump(BcOp op, BlockId target, uint32_t a, uint32_t b){
+    // the language has no loops, so every jump goes forward
+    m_fixups.emplace_back(m_code.size(), target);
+    emit(op, 0, a, b);
+}
+
+void BytecodeBuilder::add(const IrFunction& fn){
+    allocate(fn);
+    m_slots = std::max(m_slots, fn.slot_base + fn.new_slots);
+    m_block_start.assign(fn.blocks.size(), 0);
+    m_fixups.clear();
+    const IrInst* condition = nullptr;    // the fused eq the branch compares with
+
+    for (BlockId id = 0; id < fn.blocks.size(); ++id){
+        const IrBlock& block = fn.blocks[id];
+        if (block.dead) continue;
+        m_next = id + 1;
+        while (m_next < fn.blocks.size() && fn.blocks[m_next].dead) ++m_next;
+        m_block_start[id] = static_cast<uint32_t>(m_code.size());
+        for (const IrInst& inst : block.insts){
+            switch (inst.op){
+                case IrOp::const_:
+                case IrOp::phi:
+                case IrOp::ret:
+                    break;
+                case IrOp::load:
+                    emit(BcOp::mov, operand(inst.dst), k_slot | static_cast<uint32_t>(inst.imm));
+                    break;
+                case IrOp::store:
+                    emit(BcOp::mov, k_slot | static_cast<uint32_t>(inst.imm), operand(inst.a));
+                    break;
+                case IrOp::add:
+                case IrOp::sub:
+                case IrOp::mul:
+                case IrOp::div:
+                case IrOp::eq: {
+                    if (inst.op == IrOp::eq && m_fused[inst.dst]) {
+                        condition = &inst;
+                        break;
+                    }
+                    static constexpr BcOp ops[] = {BcOp::add, BcOp::sub, BcOp::mul, BcOp::div, BcOp::eq};
+                    const BcOp op = ops[static_cast<size_t>(inst.op) - static_cast<size_t>(IrOp::add)];
+                    emit(op, operand(inst.dst), operand(inst.a), operand(inst.b));
+                    break;
+                }
+                case IrOp::jump: {
+                    const BlockId target = static_cast<BlockId>(inst.imm);
+                    gen_phi_moves(fn, id, target);
+                    if (target != m_next) emit_jump(BcOp::jmp, target);
+                    break;
+                }
+                case IrOp::branch: {
+                    const BlockId then_block = static_cast<BlockId>(inst.imm);
+                    const BlockId else_block = inst.b;
+                    const bool fused = m_fused[inst.a];
+                    const uint32_t a = fused ? operand(condition->a) : operand(inst.a);
+                    const uint32_t b = fused ? operand(condition->b) : 0;
+                    const BcOp to_else = fused ? BcOp::jne : BcOp::jz;
+                    const BcOp to_then = fused ? BcOp::jeq : BcOp::jnz;
+                    if (then_block == m_next) {
+                        emit_jump(to_else, else_block, a, b);
+                    } else if (else_block == m_next) {
+                        emit_jump(to_then, then_block, a, b);
+                    } else {
+                        emit_jump(to_else, else_block, a, b);
+                        emit_jump(BcOp::jmp, then_block);
+                    }
+                    break;
+                }
+                case IrOp::exit:
+                    emit(BcOp::exit, 0, operand(inst.a));
+                    break;
+            }
+        }
+    }
+    for (const auto& [at, block] : m_fixups) m_code[at].dst = m_block_start[block];
+}
+
+void BytecodeBuilder::gen_phi_moves(const IrFunction& fn, BlockId from, BlockId to){
+    const IrBlock& target = fn.blocks[to];
+    const size_t column = static_cast<size_t>(std::find(target.preds.begin(), target.preds.end(), from) - target.preds.begin());
+    std::vector<Move> moves;
+    for (const IrInst& inst : target.insts){
+        if (inst.op != IrOp::phi) break;
+        moves.push_back({.dst = operand(inst.dst), .src = operand(fn.args(inst)[column])});
+    }
+    gen_parallel_moves(moves);
+}
+
+// Same as Generator::gen_parallel_moves, with temporary 0 in place of rdx.
+void BytecodeBuilder::gen_parallel_moves(std::vector<Move>& moves){
+    std::erase_if(moves, [](const Move& m){ return m.dst == m.src; });
+    while (!moves.empty()){
+        const auto ready = std::find_if(moves.begin(), moves.end(), [&](const Move& m){
+            return std::none_of(moves.begin(), moves.end(), [&](const Move& other){ return other.src == m.dst; });
+        });
+        if (ready != moves.end()) {
+            emit(BcOp::mov, ready->dst, ready->src);
+            moves.erase(ready);
+            continue;
+        }
+        const uint32_t parked = moves.front().dst;
+        const uint32_t scratch = k_temp | 0;
+        emit(BcOp::mov, scratch, parked);
+        for (Move& m : moves){
+            if (m.src == parked) m.src = scratch;
+        }
+    }
+}
+
+void BytecodeBuilder::finish(){
+    if (m_finished) return;
+    m_finished = true;
+    emit(BcOp::exit, 0, constant(0));
+
+    const uint64_t slot_base = m_constants.size();
+    const uint64_t temp_base = slot_base + m_slots;
+    if (temp_base + m_temps > UINT32_MAX || m_code.size() > UINT32_MAX) {
+        throw CompileError("program too large for bytecode");
+    }
+    m_registers = static_cast<uint32_t>(temp_base + m_temps);
+    const auto place = [&](uint32_t& field){
+        const uint32_t kind = field & ~k_index_mask;
+        const uint64_t base = kind == k_const ? 0 : kind == k_slot ? slot_base : temp_base;
+        field = static_cast<uint32_t>(base + (field & k_index_mask));
+    };
+    for (BcInst& inst : m_code){
+        if (writes_dst(inst.op)) place(inst.dst);
+        if (reads_a(inst.op)) place(inst.a);
+        if (reads_b(inst.op)) place(inst.b);
+    }
+}
+
+void BytecodeBuilder::write(OutputBuffer& out) const {
+    BcHeader header{};
+    std::memcpy(header.magic, k_magic, sizeof(k_magic));
+    header.version = k_version;
+    header.registers = m_registers;
+    header.constant_count = static_cast<uint32_t>(m_constants.size());
+    header.inst_count = m_code.size();
+    out.write(std::span(reinterpret_cast<const uint8_t*>(&header), sizeof(header)));
+    out.write(std::span(reinterpret_cast<const uint8_t*>(m_constants.data()), m_constants.size() * sizeof(uint64_t)));
+    out.write(std::span(reinterpret_cast<const uint8_t*>(m_code.data()), m_code.size() * sizeof(BcInst)));
+}
+
+BytecodeFile::BytecodeFile(const std::string& path){
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw CompileError("Error: cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        m_size = static_cast<size_t>(st.st_size);
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) m_data = data;
+    }
+    close(fd);
+    const auto invalid = [&](const char* why){
+        if (m_data) munmap(m_data, m_size);
+        throw CompileError("Error: " + path + " is not a valid bytecode file: " + why);
+    };
+    if (!m_data || m_size < sizeof(BcHeader)) invalid("too short");
+
+    const auto* bytes = static_cast<const uint8_t*>(m_data);
+    BcHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, k_magic, sizeof(k_magic)) != 0) invalid("bad magic");
+    if (header.version != k_version) invalid("unsupported version");
+    const uint64_t constants_size = uint64_t{header.constant_count} * sizeof(uint64_t);
+    if (header.inst_count == 0 || header.inst_count > UINT32_MAX
+        || m_size != sizeof(BcHeader) + constants_size + header.inst_count * sizeof(BcInst)) invalid("bad size");
+    // Past the constants, a register is only worth having if an
+    // instruction names it, so a register file bigger than that is not
+    // allocated on the file's word.
+    if (header.registers < header.constant_count
+        || header.registers - header.constant_count > 3 * header.inst_count) invalid("bad register count");
+
+    m_program.constants = {reinterpret_cast<const uint64_t*>(bytes + sizeof(BcHeader)), header.constant_count};
+    m_program.code = {reinterpret_cast<const BcInst*>(bytes + sizeof(BcHeader) + constants_size), static_cast<size_t>(header.inst_count)};
+    m_program.registers = header.registers;
+
+    // Nothing may read outside the register file or run off the end. The
+    // builder only jumps forward, and a jump backward could loop forever.
+    for (size_t pc = 0; pc < m_program.code.size(); ++pc){
+        const BcInst& inst = m_program.code[pc];
+        if (static_cast<size_t>(inst.op) >= k_bc_op_count) invalid("bad opcode");
+        if (writes_dst(inst.op) && inst.dst >= header.registers) invalid("bad register");
+        if (reads_a(inst.op) && inst.a >= header.registers) invalid("bad register");
+        if (reads_b(inst.op) && inst.b >= header.registers) invalid("bad register");
+        if (is_jump(inst.op) && (inst.dst <= pc || inst.dst >= header.inst_count)) invalid("bad jump target");
+    }
+    if (m_program.code.back().op != BcOp::exit) invalid("falls off the end");
+}
+
+BytecodeFile::~BytecodeFile(){
+    munmap(m_data, m_size);
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ir.hpp"
+
+class OutputBuffer;
+
+// Register-based bytecode for the interpreter (interpreter.hpp). Every
+// instruction has the same width and names its operands by their index in
+// one register file, laid out as
+//
+//     [constants | top-level slots | temporaries]
+//
+// so an operand is read the same way whatever it holds. The constants are
+// copied into the front of the file before the program starts.
+enum class BcOp : uint8_t {
+    mov,        // dst = a
+    add,        // dst = a + b
+    sub,        // dst = a - b
+    mul,        // dst = a * b
+    div,        // dst = a / b (unsigned), traps on zero like the native code
+    eq,         // dst = a == b
+    jmp,        // goto dst
+    jz,         // if a == 0 goto dst
+    jnz,        // if a != 0 goto dst
+    jeq,        // if a == b goto dst
+    jne,        // if a != b goto dst
+    exit,       // stop with a
+};
+
+inline constexpr size_t k_bc_op_count = static_cast<size_t>(BcOp::exit) + 1;
+
+struct BcInst{
+    BcOp op;
+    uint8_t unused[3] = {};
+    uint32_t dst;       // register, or the instruction a jump goes to
+    uint32_t a;
+    uint32_t b;
+};
+static_assert(sizeof(BcInst) == 16);
+
+// A program, wherever it is stored: built in memory or mapped from a file.
+struct Bytecode{
+    std::span<const BcInst> code;
+    std::span<const uint64_t> constants;
+    uint32_t registers = 0;
+};
+
+// Lowers IR functions to bytecode, one after another; like the native
+// code, a function that ends in a ret falls through into the next one.
+// Each vreg gets a temporary, shared with vregs whose live intervals do not
+// overlap it, and phis become parallel moves at the end of the
+// predecessors. An eq whose only use is the branch right after it is
+// fused into a jeq/jne.
+class BytecodeBuilder{
+public:
+    void add(const IrFunction& fn);
+
+    // Ends the program with an exit 0 for falling off the end, and moves
+    // every operand to its place in the register file.
+    void finish();
+
+    // valid after finish(), for as long as the builder
+    Bytecode view() const {
+        return {.code = m_code, .constants = m_constants, .registers = m_registers};
+    }
+
+    // Writes the finished program in the format BytecodeFile loads.
+    void write(OutputBuffer& out) const;
+private:
+    // until finish(), an operand is a kind in its top two bits and an
+    // index among its kind below them
+    static constexpr uint32_t k_temp = 0u << 30;
+    static constexpr uint32_t k_slot = 1u << 30;
+    static constexpr uint32_t k_const = 2u << 30;
+    static constexpr uint32_t k_index_mask = (1u << 30) - 1;
+
+    struct Move{
+        uint32_t dst;
+        uint32_t src;
+    };
+
+    void allocate(const IrFunction& fn);
+    uint32_t operand(VReg vreg) const;
+    uint32_t constant(uint64_t value);
+    void emit(BcOp op, uint32_t dst, uint32_t a = 0, uint32_t b = 0){
+        m_code.push_back({.op = op, .dst = dst, .a = a, .b = b});
+    }
+    void emit_jump(BcOp op, BlockId target, uint32_t a = 0, uint32_t b = 0);
+    void gen_phi_moves(const IrFunction& fn, BlockId from, BlockId to);
+    void gen_parallel_moves(std::vector<Move>& moves);
+
+    std::vector<BcInst> m_code;
+    std::vector<uint64_t> m_constants;
+    std::unordered_map<uint64_t, uint32_t> m_constant_index;
+    uint32_t m_slots = 0;
+    uint32_t m_temps = 1;           // temporary 0 breaks cycles of moves
+    uint32_t m_registers = 0;
+    bool m_finished = false;
+
+    // per function
+    std::vector<uint32_t> m_operand;    // by vreg
+    std::vector<uint8_t> m_fused;       // by vreg: an eq only a jeq/jne reads
+    std::vector<uint32_t> m_block_start;
+    std::vector<std::pair<size_t, BlockId>> m_fixups;   // jumps to later blocks
+    BlockId m_next = 0;                 // block laid out after the current one
+};
+
+// A bytecode file mapped into memory. The header, the sizes and every
+// operand and jump target are checked, so the interpreter can trust it:
+// the register file is bounded by the code and every jump goes forward,
+// so a program always ends.
+class BytecodeFile{
+public:
+    explicit BytecodeFile(const std::string& path);
+    ~BytecodeFile();
+
+    BytecodeFile(const BytecodeFile&) = delete;
+    BytecodeFile& operator=(const BytecodeFile&) = delete;
+
+    Bytecode view() const {
+        return m_program;
+    }
+private:
+    void* m_data = nullptr;
+    size_t m_size = 0;
+    Bytecode m_program;
+};
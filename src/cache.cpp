@@ -0,0 +1,243 @@
+#include "cache.hpp"
+#include "driver.hpp"
+#include "output.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <ostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+// bumped whenever the layout of an entry changes
+static constexpr uint64_t k_format_version = 1;
+
+static constexpr size_t k_shards = 16;
+// a store trims its shard when the low bits of the key are zero, i.e. about
+// one store in 8, so the scan is paid rarely and the cache overshoots its
+// limit by a few entries at most
+static constexpr uint64_t k_trim_mask = 7;
+// a temporary or an entry without a .meta this old was left by a compiler
+// that died
+static constexpr auto k_abandoned = std::chrono::hours(1);
+
+static constexpr uint64_t k_p1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t k_p2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t k_p3 = 0x165667B19E3779F9ull;
+
+static uint64_t rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t mix(uint64_t acc, uint64_t input){
+    return rotl(acc + input * k_p2, 31) * k_p1;
+}
+
+static uint64_t avalanche(uint64_t h){
+    h = (h ^ (h >> 33)) * k_p2;
+    h = (h ^ (h >> 29)) * k_p3;
+    return h ^ (h >> 32);
+}
+
+// Four independent lanes over 32-byte blocks, finished two different ways
+// for 128 bits.
+static CompileCache::Key hash_bytes(std::string_view data, uint64_t seed){
+    uint64_t lane[4] = {seed + k_p1 + k_p2, seed + k_p2, seed, seed - k_p1};
+    const char* p = data.data();
+    size_t n = data.size();
+    for (; n >= 32; p += 32, n -= 32){
+        uint64_t block[4];
+        std::memcpy(block, p, 32);
+        for (int i = 0; i < 4; ++i) lane[i] = mix(lane[i], block[i]);
+    }
+    uint64_t tail[4] = {};
+    std::memcpy(tail, p, n);
+    for (int i = 0; i < 4; ++i) lane[i] = mix(lane[i], tail[i]);
+    const uint64_t size = data.size();
+    return {{
+        avalanche(rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) + rotl(lane[3], 18) + size),
+        avalanche(rotl(lane[3], 1) + rotl(lane[2], 7) + rotl(lane[1], 12) + rotl(lane[0], 18) + size * k_p3),
+    }};
+}
+
+std::unique_ptr<CompileCache> CompileCache::from_env(){
+    const char* dir = std::getenv("ATOM_CACHE_DIR");
+    if (!dir || !*dir) return nullptr;
+    uint64_t mib = 256;
+    if (const char* size = std::getenv("ATOM_CACHE_SIZE"); size && *size) mib = std::strtoull(size, nullptr, 10);
+    return std::make_unique<CompileCache>(dir, mib << 20);
+}
+
+CompileCache::CompileCache(std::string dir, uint64_t max_bytes) : m_dir(std::move(dir)), m_max_bytes(max_bytes) {
+    // A rebuilt compiler is a different binary; its size, inode and mtime
+    // tell it apart without reading it.
+    struct stat st{};
+    if (::stat("/proc/self/exe", &st) == 0) {
+        const uint64_t id[] = {k_format_version, st.st_dev, st.st_ino, static_cast<uint64_t>(st.st_size),
+                               static_cast<uint64_t>(st.st_mtim.tv_sec), static_cast<uint64_t>(st.st_mtim.tv_nsec)};
+        m_compiler = hash_bytes({reinterpret_cast<const char*>(id), sizeof(id)}, 0).hash[0];
+    } else {
+        // nothing to tell builds apart by, so nothing may be shared with
+        // another run
+        m_compiler = k_format_version ^ static_cast<uint64_t>(getpid()) * k_p1
+                   ^ static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+}
+
+CompileCache::Key CompileCache::key(std::string_view source, const CompileOptions& options) const {
+    const uint64_t flags = static_cast<uint64_t>(options.streaming) | static_cast<uint64_t>(options.peephole) << 1
+                         | static_cast<uint64_t>(options.emit) << 2 | static_cast<uint64_t>(options.opt_level) << 8;
+    return hash_bytes(source, m_compiler ^ avalanche(flags + k_p3));
+}
+
+std::string CompileCache::entry_path(const Key& key) const {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string name(32, '0');
+    for (int i = 0; i < 32; ++i) name[i] = digits[(key.hash[i / 16] >> (60 - 4 * (i % 16))) & 15];
+    return m_dir + '/' + name[0] + '/' + name;
+}
+
+static bool read_cost(const std::string& path, uint64_t& cost){
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    char text[32];
+    const ssize_t n = ::read(fd, text, sizeof(text));
+    close(fd);
+    return n > 0 && std::from_chars(text, text + n, cost).ec == std::errc();
+}
+
+bool CompileCache::fetch(const Key& key, const std::vector<std::string>& outputs){
+    const auto start = std::chrono::steady_clock::now();
+    const std::string base = entry_path(key);
+    const std::string meta = base + ".meta";
+    uint64_t cost = 0;
+    if (!read_cost(meta, cost)) {
+        m_misses++;
+        return false;
+    }
+    for (size_t i = 0; i < outputs.size(); ++i){
+        const std::string cached = base + '.' + std::to_string(i);
+        std::error_code ec;
+        fs::remove(outputs[i], ec);
+        if (::link(cached.c_str(), outputs[i].c_str()) == 0) continue;
+        // another file system, or one without hard links; a file evicted
+        // since the .meta was read fails here too
+        fs::copy_file(cached, outputs[i], ec);
+        if (ec) {
+            m_misses++;
+            return false;
+        }
+    }
+    // the .meta's mtime is when the entry was last used
+    utimensat(AT_FDCWD, meta.c_str(), nullptr, 0);
+    m_hits++;
+    m_saved_ns += static_cast<int64_t>(cost) - std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+void CompileCache::store(const Key& key, const std::vector<std::string>& outputs, std::chrono::nanoseconds cost){
+    // an entry bigger than its shard's share would only be evicted again
+    std::error_code ec;
+    uint64_t bytes = 0;
+    for (const std::string& output : outputs) bytes += fs::file_size(output, ec);
+    if (ec || bytes > m_max_bytes / k_shards) return;
+
+    const std::string base = entry_path(key);
+    const std::string shard = fs::path(base).parent_path().string();
+    fs::create_directories(shard, ec);
+    if (ec) return;
+
+    // unique across processes by pid, across threads by the counter
+    const std::string temp = shard + "/tmp." + std::to_string(getpid()) + '.' + std::to_string(m_temp_count++);
+    const auto place = [&](const std::string& name) {
+        fs::permissions(temp, fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write,
+                        fs::perm_options::remove, ec);
+        if (!ec) fs::rename(temp, name, ec);
+        if (!ec) return true;
+        fs::remove(temp, ec);
+        return false;
+    };
+    for (size_t i = 0; i < outputs.size(); ++i){
+        fs::copy_file(outputs[i], temp, ec);
+        if (ec || !place(base + '.' + std::to_string(i))) {
+            fs::remove(temp, ec);
+            return;
+        }
+    }
+    try {
+        OutputBuffer meta(temp, false);
+        meta << static_cast<uint64_t>(cost.count());
+        meta.flush();
+    } catch (const std::exception&) {
+        fs::remove(temp, ec);
+        return;
+    }
+    if (!place(base + ".meta")) return;
+
+    if ((key.hash[1] & k_trim_mask) == 0) trim(shard);
+}
+
+void CompileCache::trim(const std::string& shard){
+    struct Entry{
+        uint64_t bytes = 0;
+        fs::file_time_type used = fs::file_time_type::min();
+        bool complete = false;
+        std::vector<fs::path> files;
+    };
+    std::unordered_map<std::string, Entry> entries;
+    const fs::file_time_type abandoned = fs::file_time_type::clock::now() - k_abandoned;
+    std::error_code ec;
+    uint64_t total = 0;
+    for (const fs::directory_entry& file : fs::directory_iterator(shard, ec)){
+        const std::string name = file.path().filename().string();
+        const fs::file_time_type mtime = file.last_write_time(ec);
+        if (ec) continue;
+        if (name.starts_with("tmp.")) {
+            if (mtime < abandoned) fs::remove(file.path(), ec);
+            continue;
+        }
+        const uint64_t bytes = file.file_size(ec);
+        if (ec) continue;
+        const std::string stem = name.substr(0, name.find('.'));
+        Entry& entry = entries[stem];
+        entry.bytes += bytes;
+        entry.used = std::max(entry.used, mtime);
+        if (name.ends_with(".meta")) {
+            entry.complete = true;
+            // the .meta goes first, so that the entry stops being found
+            // before its files disappear
+            entry.files.insert(entry.files.begin(), file.path());
+        } else {
+            entry.files.push_back(file.path());
+        }
+        total += bytes;
+    }
+
+    std::vector<Entry*> order;
+    for (auto& [stem, entry] : entries){
+        if (!entry.complete && entry.used >= abandoned) continue;    // still being written
+        order.push_back(&entry);
+    }
+    // abandoned ones first, then the least recently used
+    std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) {
+        return a->complete != b->complete ? !a->complete : a->used < b->used;
+    });
+    const uint64_t limit = m_max_bytes / k_shards;
+    for (const Entry* entry : order){
+        if (total <= limit && entry->complete) break;
+        for (const fs::path& file : entry->files) fs::remove(file, ec);
+        total -= entry->bytes;
+    }
+}
+
+void CompileCache::report(std::ostream& out) const {
+    out << "cache: " << m_hits << " hits, " << m_misses << " misses, " << std::fixed << std::setprecision(3)
+        << static_cast<double>(std::max<int64_t>(m_saved_ns, 0)) / 1e6 << " ms saved\n";
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct CompileOptions;
+
+// Outputs of earlier compiles, keyed by a hash of the source, the compiler
+// binary and the options that change what is generated. An entry is one
+// file per output plus a .meta file with what the compile cost; the .meta
+// is renamed into place last, so an entry without one is not there yet.
+// Everything is written under a temporary name and renamed, which keeps
+// concurrent compilers (threads or processes) from seeing half an entry.
+//
+// Entries are spread over 16 subdirectories. Storing into one now and then
+// evicts its least recently used entries until it is under its share of
+// the size limit. Cached files are read-only, since outputs are
+// hard-linked to them.
+class CompileCache{
+public:
+    // The cache in $ATOM_CACHE_DIR, or none if that is unset;
+    // $ATOM_CACHE_SIZE caps it in MiB (256 by default).
+    static std::unique_ptr<CompileCache> from_env();
+
+    CompileCache(std::string dir, uint64_t max_bytes);
+
+    struct Key{
+        uint64_t hash[2];
+    };
+
+    Key key(std::string_view source, const CompileOptions& options) const;
+
+    // Puts the cached files for key in place of outputs, hard-linked (or
+    // copied where a link cannot be made). False on a miss.
+    bool fetch(const Key& key, const std::vector<std::string>& outputs);
+
+    // Copies outputs into the cache under key, along with what it took to
+    // make them. Failing to store is not an error; outputs bigger than a
+    // subdirectory's share of the limit are not stored.
+    void store(const Key& key, const std::vector<std::string>& outputs, std::chrono::nanoseconds cost);
+
+    // hits, misses and the compile time the hits saved
+    void report(std::ostream& out) const;
+private:
+    std::string entry_path(const Key& key) const;
+    void trim(const std::string& shard);
+
+    std::string m_dir;
+    uint64_t m_max_bytes;
+    uint64_t m_compiler = 0;        // identifies the compiler binary
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<int64_t> m_saved_ns{0};
+    std::atomic<uint64_t> m_temp_count{0};
+};
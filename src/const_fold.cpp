@@ -0,0 +1,220 @@
+#include "const_fold.hpp"
+#include "error.hpp"
+
+ConstFolder::ConstFolder(Ast& ast, const Interner& interner) : m_ast(ast), m_interner(interner) {}
+
+nodeProg ConstFolder::fold_prog(nodeProg prog){
+    m_assigned.assign(m_ast.stmts.size(), false);
+    m_lets.clear();
+    find_assigned(m_ast.list(prog.stmts));
+    const size_t base = m_pending.size();
+    fold_list(prog.stmts);
+    return nodeProg{.stmts = commit_list(base)};
+}
+
+void ConstFolder::fold_top_stmt(NodeId stmt, std::vector<NodeId>& out){
+    m_streaming = true;
+    m_assigned.assign(m_ast.stmts.size(), false);
+    m_lets.clear();
+    find_assigned({&stmt, 1});
+    const size_t base = m_pending.size();
+    fold_stmt(stmt);
+    out.insert(out.end(), m_pending.begin() + static_cast<std::ptrdiff_t>(base), m_pending.end());
+    m_pending.resize(base);
+}
+
+void ConstFolder::find_assigned(std::span<const NodeId> stmts){
+    for (const NodeId stmt : stmts){
+        const nodeStmt& node = m_ast.stmt(stmt);
+        switch (node.kind){
+            case StmtKind::let:
+                m_lets.declare(node.ident, stmt);
+                break;
+            case StmtKind::assign:
+                // lets from earlier streamed statements are not tracked
+                if (const NodeId* let = m_lets.find(node.ident)) m_assigned[*let] = true;
+                break;
+            case StmtKind::scope:
+                m_lets.begin_scope();
+                find_assigned(m_ast.list(node.scope));
+                m_lets.end_scope();
+                break;
+            case StmtKind::if_:
+                m_lets.begin_scope();
+                find_assigned(m_ast.list(node.scope));
+                m_lets.end_scope();
+                for (NodeId pred = node.pred; pred != k_no_node; pred = m_ast.pred(pred).next){
+                    m_lets.begin_scope();
+                    find_assigned(m_ast.list(m_ast.pred(pred).scope));
+                    m_lets.end_scope();
+                }
+                break;
+            case StmtKind::exit:
+                break;
+        }
+    }
+}
+
+std::optional<uint64_t> ConstFolder::fold_expr(NodeId expr){
+    nodeExpr& node = m_ast.exprs[expr];
+    uint64_t value = 0;
+    if (node.kind == ExprKind::int_lit){
+        return m_ast.int_value(node);
+    } else if (node.kind == ExprKind::ident){
+        const Binding* binding = m_names.find(node.ident);
+        if (!binding){
+            throw CompileError("undefined identifier: " + std::string(m_interner.name(node.ident)));
+        }
+        if (!binding->constant) return {};
+        value = binding->value;
+    } else {
+        const std::optional<uint64_t> lhs = fold_expr(node.lhs);
+        const std::optional<uint64_t> rhs = fold_expr(node.rhs);
+        if (!lhs || !rhs) return {};
+        switch (node.kind){
+            case ExprKind::add: value = *lhs + *rhs; break;
+            case ExprKind::sub: value = *lhs - *rhs; break;
+            case ExprKind::multi: value = *lhs * *rhs; break;
+            case ExprKind::div:
+                if (*rhs == 0) return {};
+                value = *lhs / *rhs;
+                break;
+            case ExprKind::eq: value = *lhs == *rhs; break;
+            default: return {};
+        }
+    }
+    m_ast.ints.push_back(value);
+    node.kind = ExprKind::int_lit;
+    node.lit = static_cast<uint32_t>(m_ast.ints.size() - 1);
+    node.rhs = k_no_node;
+    return value;
+}
+
+void ConstFolder::fold_list(StmtRange stmts){
+    const size_t base = m_pending.size();
+    bool dead = false;
+    // by index: folding nested blocks appends to stmt_lists
+    for (uint32_t i = 0; i < stmts.count; ++i){
+        const size_t before = m_pending.size();
+        fold_stmt(m_ast.stmt_lists[stmts.first + i]);
+        if (dead) {
+            // still folded for its diagnostics, but never runs
+            m_pending.resize(before);
+        } else if (m_pending.size() > base && m_ast.stmt(m_pending.back()).kind == StmtKind::exit) {
+            dead = true;
+        }
+    }
+}
+
+StmtRange ConstFolder::fold_scope(StmtRange scope){
+    const size_t base = m_pending.size();
+    m_names.begin_scope();
+    ++m_depth;
+    fold_list(scope);
+    --m_depth;
+    m_names.end_scope();
+    return commit_list(base);
+}
+
+void ConstFolder::fold_stmt(NodeId stmt){
+    nodeStmt& node = m_ast.stmts[stmt];
+    switch (node.kind){
+        case StmtKind::exit:
+            fold_expr(node.expr);
+            m_pending.push_back(stmt);
+            break;
+        case StmtKind::let: {
+            if (m_names.find(node.ident)) {
+                throw CompileError("identifier already used: " + std::string(m_interner.name(node.ident)));
+            }
+            const std::optional<uint64_t> value = fold_expr(node.expr);
+            if (value && !m_assigned[stmt] && !(m_streaming && m_depth == 0)) {
+                m_names.declare(node.ident, {.constant = true, .value = *value});
+            } else {
+                m_names.declare(node.ident, {.constant = false, .value = 0});
+                m_pending.push_back(stmt);
+            }
+            break;
+        }
+        case StmtKind::assign:
+            if (!m_names.find(node.ident)) {
+                throw CompileError("undefined variable: " + std::string(m_interner.name(node.ident)));
+            }
+            fold_expr(node.expr);
+            m_pending.push_back(stmt);
+            break;
+        case StmtKind::scope:
+            emit_block(stmt, fold_scope(node.scope));
+            break;
+        case StmtKind::if_:
+            fold_if(stmt);
+            break;
+    }
+}
+
+void ConstFolder::fold_if(NodeId stmt){
+    nodeStmt& node = m_ast.stmts[stmt];
+    const std::optional<uint64_t> cond = fold_expr(node.expr);
+    const StmtRange body = fold_scope(node.scope);
+
+    // every branch is folded, but only the ones that can still be taken
+    // stay linked; closed means an earlier branch always is
+    bool closed = cond && *cond;
+    NodeId first = k_no_node;
+    NodeId* link = &first;
+    for (NodeId pred = node.pred; pred != k_no_node;){
+        nodeIfPred& branch = m_ast.preds[pred];
+        const NodeId next = branch.next;
+        std::optional<uint64_t> branch_cond;
+        if (branch.kind == PredKind::elif) branch_cond = fold_expr(branch.expr);
+        branch.scope = fold_scope(branch.scope);
+        const bool never = branch.kind == PredKind::elif && branch_cond && !*branch_cond;
+        if (!closed && !never) {
+            if (branch_cond && *branch_cond) branch.kind = PredKind::else_;
+            closed = branch.kind == PredKind::else_;
+            branch.next = k_no_node;
+            *link = pred;
+            link = &branch.next;
+        }
+        pred = next;
+    }
+
+    if (cond && *cond) {
+        emit_block(stmt, body);
+    } else if (!cond) {
+        node.scope = body;
+        node.pred = first;
+        m_pending.push_back(stmt);
+    } else if (first != k_no_node) {
+        // the first remaining branch becomes the head of the chain
+        const nodeIfPred& head = m_ast.pred(first);
+        if (head.kind == PredKind::else_) {
+            emit_block(stmt, head.scope);
+        } else {
+            node.expr = head.expr;
+            node.scope = head.scope;
+            node.pred = head.next;
+            m_pending.push_back(stmt);
+        }
+    }
+}
+
+void ConstFolder::emit_block(NodeId stmt, StmtRange block){
+    for (const NodeId inner : m_ast.list(block)){
+        if (m_ast.stmt(inner).kind == StmtKind::let) {
+            nodeStmt& node = m_ast.stmts[stmt];
+            node.kind = StmtKind::scope;
+            node.scope = block;
+            m_pending.push_back(stmt);
+            return;
+        }
+    }
+    m_pending.insert(m_pending.end(), m_ast.list(block).begin(), m_ast.list(block).end());
+}
+
+StmtRange ConstFolder::commit_list(size_t base){
+    const StmtRange range{.first = static_cast<uint32_t>(m_ast.stmt_lists.size()), .count = static_cast<uint32_t>(m_pending.size() - base)};
+    m_ast.stmt_lists.insert(m_ast.stmt_lists.end(), m_pending.begin() + static_cast<std::ptrdiff_t>(base), m_pending.end());
+    m_pending.resize(base);
+    return range;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <vector>
+#include "ast.hpp"
+#include "interner.hpp"
+#include "symbol_table.hpp"
+
+// -O1: rewrites the AST in place between parsing and code generation.
+//  - binary expressions over literals are folded (division by zero is left
+//    for run time);
+//  - variables that are never assigned after their let are replaced by
+//    their value when it is constant, and the let itself is dropped;
+//  - if/elif chains with constant conditions keep only the branch taken;
+//  - statements after an exit in the same block are dropped, and blocks
+//    that declare nothing are spliced into the enclosing one.
+// Name errors are reported here, with the generator's messages, so code
+// that gets dropped is still checked.
+class ConstFolder{
+public:
+    ConstFolder(Ast& ast, const Interner& interner);
+
+    nodeProg fold_prog(nodeProg prog);
+
+    // Streaming mode: folds one top-level statement and appends what is
+    // left of it to out. Top-level lets may be assigned by statements that
+    // have not been parsed yet, so they are never propagated.
+    void fold_top_stmt(NodeId stmt, std::vector<NodeId>& out);
+private:
+    struct Binding{
+        bool constant;
+        uint64_t value;
+    };
+
+    void find_assigned(std::span<const NodeId> stmts);
+
+    std::optional<uint64_t> fold_expr(NodeId expr);
+    void fold_list(StmtRange stmts);
+    void fold_stmt(NodeId stmt);
+    StmtRange fold_scope(StmtRange scope);
+    void fold_if(NodeId stmt);
+
+    // Appends an already folded block to m_pending: its statements are
+    // spliced in if it declares nothing, otherwise stmt is turned into a
+    // scope statement for it.
+    void emit_block(NodeId stmt, StmtRange block);
+
+    StmtRange commit_list(size_t base);
+
+    Ast& m_ast;
+    const Interner& m_interner;
+    bool m_streaming = false;
+    int m_depth = 0;
+    SymbolTable<Binding> m_names;
+    SymbolTable<NodeId> m_lets;      // used by find_assigned()
+    std::vector<bool> m_assigned;    // by let NodeId
+    std::vector<NodeId> m_pending;
+};
@@ -0,0 +1,430 @@
+#include "driver.hpp"
+#include "bytecode.hpp"
+#include "cache.hpp"
+#include "const_fold.hpp"
+#include "elf.hpp"
+#include "encoder.hpp"
+#include "error.hpp"
+#include "generation.hpp"
+#include "interpreter.hpp"
+#include "ir_builder.hpp"
+#include "jit.hpp"
+#include "output.hpp"
+#include "parser.hpp"
+#include "passes.hpp"
+#include "peephole.hpp"
+#include "pipeline.hpp"
+#include "source.hpp"
+#include "stats.hpp"
+#include "tokenization.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+// Where generated code goes: IR or NASM text, an executable, bytecode, or
+// memory that is run in this process.
+class CodeSink{
+public:
+    CodeSink(OutputBuffer& out, Emit emit) : m_out(&out), m_emit(emit) {
+        if (emit == Emit::binary) m_elf.emplace(out);
+        if (emit == Emit::bytecode) m_bytecode = &m_own_bytecode;
+    }
+    explicit CodeSink(JitBuffer& jit) : m_jit(&jit) {}
+    explicit CodeSink(BytecodeBuilder& bytecode) : m_emit(Emit::bytecode), m_bytecode(&bytecode) {}
+
+    // IR text and bytecode are made from the IR functions, not by the
+    // Generator
+    bool takes_ir() const {
+        return m_emit == Emit::ir || m_emit == Emit::bytecode;
+    }
+
+    bool in_process() const {
+        return m_jit != nullptr;
+    }
+
+    void function(const IrFunction& fn, PassManager& passes){
+        if (m_bytecode) passes.time("bytecode", [&]{ m_bytecode->add(fn); });
+        else passes.time("write", [&]{ dump_ir(fn, *m_out); });
+    }
+
+    void flush(Generator& generator, PassManager& passes){
+        if (m_jit) {
+            passes.time("encode", [&]{ generator.flush(m_encoder); });
+            passes.time("write", [&]{ m_encoder.flush(*m_jit); });
+            return;
+        }
+        if (!m_elf) {
+            passes.time("write", [&]{ generator.flush(*m_out); });
+            return;
+        }
+        passes.time("encode", [&]{ generator.flush(m_encoder); });
+        passes.time("write", [&]{ m_encoder.flush(*m_elf); });
+    }
+
+    void finish(PassManager& passes){
+        if (m_bytecode) passes.time("bytecode", [&]{ m_bytecode->finish(); });
+        if (!m_out) return;
+        passes.time("write", [&]{
+            if (m_bytecode) m_bytecode->write(*m_out);
+            if (m_elf) m_elf->finish();
+            else m_out->flush();
+        });
+    }
+private:
+    OutputBuffer* m_out = nullptr;
+    Emit m_emit = Emit::binary;
+    Encoder m_encoder;
+    std::optional<ElfWriter> m_elf;
+    JitBuffer* m_jit = nullptr;
+    BytecodeBuilder* m_bytecode = nullptr;
+    BytecodeBuilder m_own_bytecode;     // for --emit=bc
+};
+
+// Folds, lowers and generates top-level statements one at a time, with
+// top-level variables in slots. The streaming and the pipelined compile
+// differ only in where the statements come from.
+class StmtCompiler{
+public:
+    StmtCompiler(Ast& ast, const Interner& interner, const CompileOptions& options, PassManager& passes,
+                 Peephole* peephole, CodeSink& sink)
+        : m_folder(ast, interner), m_builder(ast, interner), m_generator(peephole, sink.in_process()),
+          m_options(options), m_passes(passes), m_sink(sink) {
+        if (!m_sink.takes_ir()) m_generator.begin_prog();
+    }
+
+    void add(NodeId stmt){
+        m_folded.assign(1, stmt);
+        if (m_options.opt_level > 0) {
+            m_folded.clear();
+            m_passes.time("ast-fold", [&]{ m_folder.fold_top_stmt(stmt, m_folded); });
+        }
+        for (const NodeId top : m_folded) {
+            m_passes.time("build-ir", [&]{ m_builder.build_top_stmt(top, m_fn); });
+            m_passes.run(m_fn);
+            if (m_sink.takes_ir()) m_sink.function(m_fn, m_passes);
+            else m_passes.time("codegen", [&]{ m_generator.gen_function(m_fn); });
+        }
+    }
+
+    // Hands everything added so far to the sink, so the nodes it came from
+    // can go.
+    void flush(){
+        if (m_sink.takes_ir()) return;
+        m_passes.time("peephole", [&]{ m_generator.optimize(); });
+        m_sink.flush(m_generator, m_passes);
+    }
+
+    void finish(){
+        if (!m_sink.takes_ir()) {
+            m_generator.end_prog();
+            flush();
+        }
+        m_sink.finish(m_passes);
+    }
+private:
+    ConstFolder m_folder;
+    IrBuilder m_builder;
+    Generator m_generator;
+    const CompileOptions& m_options;
+    PassManager& m_passes;
+    CodeSink& m_sink;
+    IrFunction m_fn;
+    std::vector<NodeId> m_folded;
+};
+
+// Parses and generates one top-level statement at a time, so only the
+// statement currently being compiled is kept in memory.
+static void compile_streaming(Tokenizer& tokenizer, const Interner& interner, Ast& ast, const CompileOptions& options,
+                              PassManager& passes, Peephole* peephole, CodeSink& sink, CompileStats* stats){
+    Parser parser(tokenizer, ast);
+    StmtCompiler compiler(ast, interner, options, passes, peephole, sink);
+    while (!parser.at_end()) {
+        std::optional<NodeId> stmt;
+        passes.time("parse", [&]{ stmt = parser.parse_stmt(); });
+        if (!stmt) {
+            throw CompileError("invalid statement");
+        }
+        if (stats) stats->count_nodes(ast);
+        compiler.add(stmt.value());
+        compiler.flush();
+        parser.release_nodes();
+    }
+    compiler.finish();
+}
+
+// The same on three threads: the tokenizer and the parser run ahead on
+// their own while this one generates code, a batch of statements at a
+// time.
+static void compile_pipelined(Tokenizer& tokenizer, const Interner& interner, Ast& ast, const CompileOptions& options,
+                              PassManager& passes, Peephole* peephole, CodeSink& sink, CompileStats* stats){
+    ParsePipeline pipeline(tokenizer, passes);
+    StmtCompiler compiler(ast, interner, options, passes, peephole, sink);
+    std::vector<NodeId> stmts;
+    while (true) {
+        bool more = false;
+        passes.time("wait", [&]{ more = pipeline.next(ast, stmts); });
+        if (!more) break;
+        if (stats) stats->count_nodes(ast);
+        for (const NodeId stmt : stmts) compiler.add(stmt);
+        compiler.flush();
+    }
+    compiler.finish();
+    passes.merge(pipeline.timings());
+}
+
+// stats, if given, gets the token and node counts
+static void compile(std::string_view contents, const CompileOptions& options, CompileContext& ctx, PassManager& passes,
+                    Peephole* peephole, CodeSink& sink, CompileStats* stats){
+    if (contents.empty()) {
+        throw CompileError("Error: Input file is empty");
+    }
+
+    ctx.interner.clear();
+    ctx.ast.clear();
+    ctx.tokens.clear();
+    Tokenizer tokenizer(contents, ctx.interner);
+
+    if (options.pipelined) {
+        compile_pipelined(tokenizer, ctx.interner, ctx.ast, options, passes, peephole, sink, stats);
+        if (stats) stats->tokens = tokenizer.token_count();
+        return;
+    }
+    if (options.streaming) {
+        compile_streaming(tokenizer, ctx.interner, ctx.ast, options, passes, peephole, sink, stats);
+        if (stats) stats->tokens = tokenizer.token_count();
+        return;
+    }
+    passes.time("lex", [&]{ tokenizer.tokenize(ctx.tokens); });
+
+    Parser parser(std::move(ctx.tokens), ctx.ast);
+    std::optional<nodeProg> prog;
+    passes.time("parse", [&]{ prog = parser.parse_prog(); });
+    if (!prog.has_value()){
+        throw CompileError("invalid program");
+    }
+    if (stats) {
+        stats->tokens = tokenizer.token_count();
+        stats->count_nodes(ctx.ast);
+    }
+    ctx.tokens = parser.release_tokens();
+    if (options.opt_level > 0) {
+        passes.time("ast-fold", [&]{ prog = ConstFolder(ctx.ast, ctx.interner).fold_prog(prog.value()); });
+    }
+
+    IrFunction fn;
+    passes.time("build-ir", [&]{ IrBuilder(ctx.ast, ctx.interner).build_prog(prog.value(), fn); });
+    passes.run(fn);
+
+    if (sink.takes_ir()) {
+        sink.function(fn, passes);
+    } else {
+        Generator generator(peephole, sink.in_process());
+        passes.time("codegen", [&]{
+            generator.begin_prog();
+            generator.gen_function(fn);
+            generator.end_prog();
+        });
+        passes.time("peephole", [&]{ generator.optimize(); });
+        sink.flush(generator, passes);
+    }
+    sink.finish(passes);
+}
+
+// Set up before a compile for --stats and --trace; costs nothing without
+// them.
+static void instrument(PassManager& passes, const CompileOptions& options, const CompileContext& ctx){
+    if (options.stats || ctx.trace) passes.instrument(options.stats, ctx.trace);
+}
+
+// --time-passes, --stats and --peephole-stats, at the end of a compile of
+// input. The report is written in one piece, headed by the input, so
+// those of a parallel batch do not run into each other.
+static void report(PassManager& passes, const CompileOptions& options, const CompileContext& ctx, const CompileStats& stats,
+                   const Peephole* peephole, std::chrono::steady_clock::time_point start, std::string_view input){
+    if (ctx.trace) ctx.trace->span("compile", start, std::chrono::steady_clock::now(), input);
+    passes.settle_cpu();
+    const bool peephole_stats = peephole && options.peephole_stats;
+    if (!options.time_passes && !options.stats && !peephole_stats) return;
+    std::ostringstream text;
+    text << input << ":\n";
+    if (options.time_passes || options.stats) passes.report(text);
+    if (options.stats) stats.report(text);
+    if (peephole_stats) peephole->report(text);
+
+    static std::mutex mutex;
+    const std::lock_guard lock(mutex);
+    std::cerr << text.str();
+}
+
+// nasm and ld run as processes of their own, with CPU time and memory
+// outside ours
+static void record_tool(PassManager& passes, CompileStats& stats, const char* name, const rusage& usage){
+    passes.record_cpu(name, std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+                            + std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec));
+    stats.tool_peak_rss_kb = std::max(stats.tool_peak_rss_kb, usage.ru_maxrss);
+}
+
+void compile_file(const std::string& input, const std::string& output, const CompileOptions& options, CompileContext& ctx){
+    const SourceFile source(input);
+    compile_source(source.view(), output, options, ctx, input);
+}
+
+void compile_source(std::string_view contents, const std::string& output, const CompileOptions& options, CompileContext& ctx,
+                    std::string_view input){
+    const std::string asm_path = output + ".asm";
+    const std::string obj_path = output + ".o";
+    const std::string out_path = options.emit == Emit::ir ? output + ".ir"
+                               : options.emit == Emit::bytecode ? output + ".bc"
+                               : options.emit == Emit::assembly ? asm_path : output;
+    const std::vector<std::string> outputs = options.emit == Emit::assembly ? std::vector{asm_path, obj_path, output}
+                                                                            : std::vector{out_path};
+
+    const auto begin = std::chrono::steady_clock::now();
+    PassManager passes;
+    add_passes(passes, options.opt_level);
+    instrument(passes, options, ctx);
+    Peephole peephole;
+    CompileStats stats;
+    const auto count_outputs = [&] {
+        if (!options.stats) return;
+        for (const std::string& path : outputs){
+            std::error_code ec;
+            const uint64_t bytes = std::filesystem::file_size(path, ec);
+            if (!ec) stats.outputs.emplace_back(path, bytes);
+        }
+    };
+
+    CompileCache::Key key{};
+    if (ctx.cache) {
+        bool hit = false;
+        passes.time("cache", [&]{
+            key = ctx.cache->key(contents, options);
+            hit = ctx.cache->fetch(key, outputs);
+        });
+        if (hit) {
+            count_outputs();
+            report(passes, options, ctx, stats, nullptr, begin, input);
+            return;
+        }
+    }
+
+    // fresh files, so that an executable that is still running, or one
+    // hard-linked into the cache, does not get in the way
+    const auto start = std::chrono::steady_clock::now();
+    for (const std::string& path : outputs){
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        if (ec) throw CompileError("Error: cannot replace " + path + ": " + ec.message());
+    }
+
+    try {
+        {
+            OutputBuffer file(out_path, options.emit == Emit::binary);
+            CodeSink sink(file, options.emit);
+            compile(contents, options, ctx, passes, options.peephole ? &peephole : nullptr, sink, options.stats ? &stats : nullptr);
+        }
+        if (options.emit == Emit::assembly) {
+            rusage usage{};
+            passes.time_tool("nasm", [&]{
+                if (!run_tool({"nasm", "-felf64", asm_path, "-o", obj_path}, &usage)) {
+                    throw CompileError("nasm failed on " + asm_path);
+                }
+            });
+            if (options.stats) record_tool(passes, stats, "nasm", usage);
+            passes.time_tool("ld", [&]{
+                if (!run_tool({"ld", "-o", output, obj_path}, &usage)) {
+                    throw CompileError("ld failed on " + obj_path);
+                }
+            });
+            if (options.stats) record_tool(passes, stats, "ld", usage);
+        }
+    } catch (...) {
+        // half an output, or the .asm and .o of a failed link, must not be
+        // left behind
+        for (const std::string& path : outputs){
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+        throw;
+    }
+    if (ctx.cache) {
+        const auto cost = std::chrono::steady_clock::now() - start;
+        passes.time("cache", [&]{ ctx.cache->store(key, outputs, cost); });
+    }
+    count_outputs();
+    report(passes, options, ctx, stats, &peephole, begin, input);
+}
+
+uint64_t run_file(const std::string& input, const CompileOptions& options, CompileContext& ctx){
+    const SourceFile source(input);
+    return run_source(source.view(), options, ctx, input);
+}
+
+uint64_t run_source(std::string_view contents, const CompileOptions& options, CompileContext& ctx, std::string_view input){
+    const auto begin = std::chrono::steady_clock::now();
+    PassManager passes;
+    add_passes(passes, options.opt_level);
+    instrument(passes, options, ctx);
+    Peephole peephole;
+    CompileStats stats;
+    JitBuffer jit;
+    CodeSink sink(jit);
+    compile(contents, options, ctx, passes, options.peephole ? &peephole : nullptr, sink, options.stats ? &stats : nullptr);
+    stats.outputs.emplace_back("code", jit.size());
+
+    uint64_t result = 0;
+    passes.time("run", [&]{ result = jit.run(); });
+    report(passes, options, ctx, stats, &peephole, begin, input);
+    return result;
+}
+
+uint64_t interpret_file(const std::string& input, const CompileOptions& options, CompileContext& ctx){
+    if (input.ends_with(".bc")) {
+        const BytecodeFile file(input);
+        return interpret(file.view());
+    }
+    const SourceFile source(input);
+    return interpret_source(source.view(), options, ctx, input);
+}
+
+uint64_t interpret_source(std::string_view contents, const CompileOptions& options, CompileContext& ctx, std::string_view input){
+    const auto begin = std::chrono::steady_clock::now();
+    PassManager passes;
+    add_passes(passes, options.opt_level);
+    instrument(passes, options, ctx);
+    CompileStats stats;
+    BytecodeBuilder bytecode;
+    CodeSink sink(bytecode);
+    compile(contents, options, ctx, passes, nullptr, sink, options.stats ? &stats : nullptr);
+    const Bytecode code = bytecode.view();
+    stats.outputs.emplace_back("bytecode", code.code.size_bytes() + code.constants.size_bytes());
+
+    uint64_t result = 0;
+    passes.time("run", [&]{ result = interpret(code); });
+    report(passes, options, ctx, stats, nullptr, begin, input);
+    return result;
+}
+
+bool run_tool(const std::vector<std::string>& argv, rusage* usage){
+    std::vector<char*> args;
+    for (const std::string& arg : argv) args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(nullptr);
+    pid_t pid;
+    if (posix_spawnp(&pid, args[0], nullptr, nullptr, args.data(), environ) != 0) return false;
+    int status = 0;
+    while (wait4(pid, &status, 0, usage) < 0) {
+        if (errno != EINTR) return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <string_view>
+#include "ast.hpp"
+#include "interner.hpp"
+#include "tokenization.hpp"
+
+struct rusage;
+class CompileCache;
+class Trace;
+
+enum class Emit : uint8_t {
+    binary,     // encode and write the executable directly
+    assembly,   // write output.asm and build it with nasm and ld
+    ir,         // write output.ir and stop
+    bytecode,   // write output.bc for --interp
+};
+
+struct CompileOptions{
+    bool streaming = false;
+    bool pipelined = false;     // streaming, with lexer, parser and codegen on threads of their own
+    int opt_level = 0;      // -O1: constant folding and propagation
+    Emit emit = Emit::binary;
+    bool time_passes = false;
+    bool peephole = true;
+    bool peephole_stats = false;    // report how often each peephole rule fired
+    bool stats = false;     // report CPU time per stage, sizes and memory
+};
+
+// State that is reused from one compile to the next on the same thread,
+// so a batch (or a compile server) does not reallocate the node pools,
+// intern table and token buffer for every file.
+struct CompileContext{
+    Ast ast;
+    Interner interner;
+    std::vector<Token> tokens;
+    CompileCache* cache = nullptr;      // shared by every context; none if caching is off
+    Trace* trace = nullptr;             // shared likewise; none without --trace
+};
+
+// Compiles input ("-" for stdin) into the executable output (with
+// --emit=asm, through output.asm and output.o next to it). Problems with the program are
+// reported by throwing CompileError. With a cache in ctx, a source that
+// was compiled before with the same options is not compiled again.
+void compile_file(const std::string& input, const std::string& output, const CompileOptions& options, CompileContext& ctx);
+
+// Same for a program that is already in memory; input is what reports and
+// traces call it.
+void compile_source(std::string_view contents, const std::string& output, const CompileOptions& options, CompileContext& ctx,
+                    std::string_view input = "-");
+
+// Compiles input into memory and runs it in this process instead of
+// writing an executable (options.emit is ignored). Returns the value the
+// program exits with.
+uint64_t run_file(const std::string& input, const CompileOptions& options, CompileContext& ctx);
+uint64_t run_source(std::string_view contents, const CompileOptions& options, CompileContext& ctx, std::string_view input = "-");
+
+// Compiles input to bytecode and interprets it (options.emit is ignored);
+// a .bc file written by --emit=bc is mapped and run as it is. Returns the
+// value the program exits with.
+uint64_t interpret_file(const std::string& input, const CompileOptions& options, CompileContext& ctx);
+uint64_t interpret_source(std::string_view contents, const CompileOptions& options, CompileContext& ctx,
+                          std::string_view input = "-");
+
+// Runs argv[0] (looked up in PATH) without a shell; true if it exited with 0.
+// What the process used goes to usage, if given.
+bool run_tool(const std::vector<std::string>& argv, rusage* usage = nullptr);
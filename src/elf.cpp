@@ -0,0 +1,61 @@
+#include "elf.hpp"
+#include <cstring>
+#include <elf.h>
+#include "output.hpp"
+
+static constexpr uint64_t k_load_address = 0x400000;
+static constexpr uint64_t k_headers_size = sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr);
+
+struct ElfWriter::Headers{
+    Elf64_Ehdr header;
+    Elf64_Phdr segment;
+
+    std::span<const uint8_t> bytes() const {
+        return {reinterpret_cast<const uint8_t*>(this), sizeof(*this)};
+    }
+};
+static_assert(sizeof(Elf64_Ehdr) % alignof(Elf64_Phdr) == 0, "the headers are written back to back");
+
+ElfWriter::ElfWriter(OutputBuffer& out) : m_out(out) {
+    m_out.write(headers().bytes());
+}
+
+void ElfWriter::write(std::span<const uint8_t> code){
+    m_out.write(code);
+    m_code_size += code.size();
+}
+
+void ElfWriter::finish(){
+    m_out.patch(0, headers().bytes());
+}
+
+ElfWriter::Headers ElfWriter::headers() const {
+    Headers result;
+    Elf64_Ehdr& header = result.header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_entry = k_load_address + k_headers_size;
+    header.e_phoff = sizeof(Elf64_Ehdr);
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_phentsize = sizeof(Elf64_Phdr);
+    header.e_phnum = 1;
+
+    Elf64_Phdr& segment = result.segment;
+    std::memset(&segment, 0, sizeof(segment));
+    segment.p_type = PT_LOAD;
+    segment.p_flags = PF_R | PF_X;
+    segment.p_offset = 0;
+    segment.p_vaddr = k_load_address;
+    segment.p_paddr = k_load_address;
+    segment.p_filesz = k_headers_size + m_code_size;
+    segment.p_memsz = segment.p_filesz;
+    segment.p_align = 0x1000;
+    return result;
+}
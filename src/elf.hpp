@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+class OutputBuffer;
+
+// Writes a static x86-64 Linux executable: a single read + execute segment
+// holding the ELF header, the program header and the code, which starts
+// running at its first byte. The headers go out first with the sizes left
+// blank, so code can be written as it is produced; finish() fills them in.
+class ElfWriter{
+public:
+    explicit ElfWriter(OutputBuffer& out);
+
+    void write(std::span<const uint8_t> code);
+
+    void finish();
+private:
+    struct Headers;
+    Headers headers() const;
+
+    OutputBuffer& m_out;
+    uint64_t m_code_size = 0;
+};
@@ -0,0 +1,333 @@
+#include "encoder.hpp"
+#include <algorithm>
+#include <initializer_list>
+#include "elf.hpp"
+#include "error.hpp"
+#include "jit.hpp"
+
+static uint8_t number(Reg reg){
+    return static_cast<uint8_t>(reg);
+}
+
+static bool fits_int8(uint64_t imm){
+    const int64_t value = static_cast<int64_t>(imm);
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool fits_int32(uint64_t imm){
+    const int64_t value = static_cast<int64_t>(imm);
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static void put(std::vector<uint8_t>& out, uint64_t value, int bytes){
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+static bool is_jump(MOp op){
+    return op == MOp::jmp || op == MOp::jz || op == MOp::jnz;
+}
+
+// REX prefix, opcode and ModRM (with SIB and displacement) of an
+// instruction whose ModRM.reg field holds reg, a register number or an
+// opcode extension, and whose r/m operand is rm.
+static void put_modrm(std::vector<uint8_t>& out, bool wide, std::initializer_list<uint8_t> opcode, uint8_t reg, const MOperand& rm){
+    uint8_t rex = static_cast<uint8_t>(0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2));
+    bool need_rex = false;
+    if (rm.is_reg()) {
+        rex |= number(rm.reg) >> 3;
+        // without a REX prefix these would be ah, ch, dh and bh
+        need_rex = rm.size == 1 && number(rm.reg) >= 4 && number(rm.reg) < 8;
+    } else if (rm.kind == MOperand::Kind::addr) {
+        rex |= static_cast<uint8_t>(((number(rm.index) >> 3) << 1) | (number(rm.reg) >> 3));
+    }
+    if (rex != 0x40 || need_rex) out.push_back(rex);
+    out.insert(out.end(), opcode);
+
+    const uint8_t reg_bits = static_cast<uint8_t>((reg & 7) << 3);
+    switch (rm.kind){
+        case MOperand::Kind::reg:
+            out.push_back(static_cast<uint8_t>(0xC0 | reg_bits | (number(rm.reg) & 7)));
+            break;
+        case MOperand::Kind::mem:
+            // [rsp + offset] always takes a SIB byte
+            if (rm.offset == 0) {
+                out.push_back(static_cast<uint8_t>(0x04 | reg_bits));
+                out.push_back(0x24);
+            } else if (rm.offset <= INT8_MAX) {
+                out.push_back(static_cast<uint8_t>(0x44 | reg_bits));
+                out.push_back(0x24);
+                put(out, rm.offset, 1);
+            } else {
+                out.push_back(static_cast<uint8_t>(0x84 | reg_bits));
+                out.push_back(0x24);
+                put(out, rm.offset, 4);
+            }
+            break;
+        case MOperand::Kind::addr: {
+            const uint8_t scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            const uint8_t sib = static_cast<uint8_t>((scale_bits << 6) | ((number(rm.index) & 7) << 3) | (number(rm.reg) & 7));
+            // a base of rbp or r13 needs a displacement, even a zero one
+            if ((number(rm.reg) & 7) == 5) {
+                out.push_back(static_cast<uint8_t>(0x44 | reg_bits));
+                out.push_back(sib);
+                out.push_back(0);
+            } else {
+                out.push_back(static_cast<uint8_t>(0x04 | reg_bits));
+                out.push_back(sib);
+            }
+            break;
+        }
+        default:
+            throw CompileError("cannot encode operand");
+    }
+}
+
+struct AluCodes{
+    uint8_t rm_reg;     // op r/m, r
+    uint8_t reg_rm;     // op r, r/m
+    uint8_t ext;        // op r/m, imm
+};
+
+static void put_alu(std::vector<uint8_t>& out, const AluCodes& codes, const MInst& inst){
+    const bool wide = !inst.dst.is_reg() || inst.dst.size == 8;
+    switch (inst.src.kind){
+        case MOperand::Kind::reg:
+            put_modrm(out, wide, {codes.rm_reg}, number(inst.src.reg), inst.dst);
+            break;
+        case MOperand::Kind::mem:
+            put_modrm(out, wide, {codes.reg_rm}, number(inst.dst.reg), inst.src);
+            break;
+        case MOperand::Kind::imm:
+            if (fits_int8(inst.src.imm)) {
+                put_modrm(out, wide, {0x83}, codes.ext, inst.dst);
+                put(out, inst.src.imm, 1);
+            } else if (fits_int32(inst.src.imm)) {
+                put_modrm(out, wide, {0x81}, codes.ext, inst.dst);
+                put(out, inst.src.imm, 4);
+            } else {
+                throw CompileError("immediate out of range");
+            }
+            break;
+        default:
+            throw CompileError("cannot encode operand");
+    }
+}
+
+static void put_mov(std::vector<uint8_t>& out, const MInst& inst){
+    const MOperand& dst = inst.dst;
+    const MOperand& src = inst.src;
+    if (src.is_reg()) {
+        put_modrm(out, true, {0x89}, number(src.reg), dst);
+    } else if (src.is_mem()) {
+        put_modrm(out, true, {0x8B}, number(dst.reg), src);
+    } else if (dst.is_reg() && src.imm <= UINT32_MAX) {
+        // writing the low half clears the high one
+        if (number(dst.reg) >= 8) out.push_back(0x41);
+        out.push_back(static_cast<uint8_t>(0xB8 + (number(dst.reg) & 7)));
+        put(out, src.imm, 4);
+    } else if (fits_int32(src.imm)) {
+        put_modrm(out, true, {0xC7}, 0, dst);
+        put(out, src.imm, 4);
+    } else if (dst.is_reg()) {
+        out.push_back(static_cast<uint8_t>(0x48 | (number(dst.reg) >> 3)));
+        out.push_back(static_cast<uint8_t>(0xB8 + (number(dst.reg) & 7)));
+        put(out, src.imm, 8);
+    } else {
+        throw CompileError("immediate out of range");
+    }
+}
+
+static void put_inst(std::vector<uint8_t>& out, const MInst& inst){
+    const MOperand& dst = inst.dst;
+    const MOperand& src = inst.src;
+    switch (inst.op){
+        case MOp::mov:
+            put_mov(out, inst);
+            break;
+        case MOp::movzx:
+            put_modrm(out, dst.size == 8, {0x0F, 0xB6}, number(dst.reg), src);
+            break;
+        case MOp::add:
+            put_alu(out, {0x01, 0x03, 0}, inst);
+            break;
+        case MOp::sub:
+            put_alu(out, {0x29, 0x2B, 5}, inst);
+            break;
+        case MOp::xor_:
+            put_alu(out, {0x31, 0x33, 6}, inst);
+            break;
+        case MOp::cmp:
+            put_alu(out, {0x39, 0x3B, 7}, inst);
+            break;
+        case MOp::test:
+            put_modrm(out, dst.size == 8, {0x85}, number(src.reg), dst);
+            break;
+        case MOp::imul:
+            if (!src.is_imm()) {
+                put_modrm(out, true, {0x0F, 0xAF}, number(dst.reg), src);
+            } else if (fits_int8(src.imm)) {
+                put_modrm(out, true, {0x6B}, number(dst.reg), dst);
+                put(out, src.imm, 1);
+            } else {
+                put_modrm(out, true, {0x69}, number(dst.reg), dst);
+                put(out, src.imm, 4);
+            }
+            break;
+        case MOp::mul:
+            put_modrm(out, true, {0xF7}, 4, dst);
+            break;
+        case MOp::div:
+            put_modrm(out, true, {0xF7}, 6, dst);
+            break;
+        case MOp::neg:
+            put_modrm(out, true, {0xF7}, 3, dst);
+            break;
+        case MOp::shl:
+        case MOp::shr: {
+            const uint8_t ext = inst.op == MOp::shl ? 4 : 5;
+            if (src.imm == 1) {
+                put_modrm(out, true, {0xD1}, ext, dst);
+            } else {
+                put_modrm(out, true, {0xC1}, ext, dst);
+                put(out, src.imm, 1);
+            }
+            break;
+        }
+        case MOp::lea:
+            put_modrm(out, true, {0x8D}, number(dst.reg), src);
+            break;
+        case MOp::sete:
+            put_modrm(out, false, {0x0F, 0x94}, 0, dst);
+            break;
+        case MOp::push:
+        case MOp::pop:
+            if (dst.is_reg()) {
+                if (number(dst.reg) >= 8) out.push_back(0x41);
+                out.push_back(static_cast<uint8_t>((inst.op == MOp::push ? 0x50 : 0x58) + (number(dst.reg) & 7)));
+            } else if (inst.op == MOp::push) {
+                put_modrm(out, false, {0xFF}, 6, dst);
+            } else {
+                put_modrm(out, false, {0x8F}, 0, dst);
+            }
+            break;
+        case MOp::syscall:
+            out.push_back(0x0F);
+            out.push_back(0x05);
+            break;
+        case MOp::ret:
+            out.push_back(0xC3);
+            break;
+        default:
+            throw CompileError("cannot encode instruction");
+    }
+}
+
+void Encoder::encode(std::span<const MInst> code){
+    static constexpr uint64_t in_batch = k_unknown - 1;
+    m_scratch.clear();
+    m_pieces.clear();
+    for (const MInst& inst : code){
+        if (inst.op != MOp::label) continue;
+        const uint64_t label = inst.dst.imm;
+        if (label >= m_labels.size()) m_labels.resize(label + 1, k_unknown);
+        m_labels[label] = in_batch;
+    }
+    for (uint32_t i = 0; i < code.size(); ++i){
+        const MInst& inst = code[i];
+        const uint32_t begin = static_cast<uint32_t>(m_scratch.size());
+        bool is_long = false;
+        if (inst.op == MOp::label) {
+            // placed by the layout below
+        } else if (is_jump(inst.op)) {
+            // targets further on are only known once their batch comes
+            is_long = label_at(static_cast<uint32_t>(inst.dst.imm)) == k_unknown;
+        } else {
+            put_inst(m_scratch, inst);
+        }
+        m_pieces.push_back({.begin = begin, .end = static_cast<uint32_t>(m_scratch.size()), .inst = i, .is_long = is_long});
+    }
+
+    const auto piece_size = [&](const Piece& piece) -> uint64_t {
+        const MOp op = code[piece.inst].op;
+        if (!is_jump(op)) return piece.end - piece.begin;
+        if (!piece.is_long) return 2;
+        return op == MOp::jmp ? 5 : 6;
+    };
+    m_offsets.resize(m_pieces.size());
+    for (;;){
+        uint64_t at = size();
+        for (size_t p = 0; p < m_pieces.size(); ++p){
+            m_offsets[p] = at;
+            const MInst& inst = code[m_pieces[p].inst];
+            if (inst.op == MOp::label) m_labels[inst.dst.imm] = at;
+            at += piece_size(m_pieces[p]);
+        }
+        bool grown = false;
+        for (size_t p = 0; p < m_pieces.size(); ++p){
+            Piece& piece = m_pieces[p];
+            const MInst& inst = code[piece.inst];
+            if (!is_jump(inst.op) || piece.is_long) continue;
+            const int64_t distance = static_cast<int64_t>(m_labels[inst.dst.imm] - (m_offsets[p] + 2));
+            if (!fits_int8(static_cast<uint64_t>(distance))) {
+                piece.is_long = true;
+                grown = true;
+            }
+        }
+        if (!grown) break;
+    }
+
+    for (const Piece& piece : m_pieces){
+        const MInst& inst = code[piece.inst];
+        if (inst.op == MOp::label) continue;
+        if (!is_jump(inst.op)) {
+            m_code.insert(m_code.end(), m_scratch.begin() + piece.begin, m_scratch.begin() + piece.end);
+            continue;
+        }
+        const uint32_t label = static_cast<uint32_t>(inst.dst.imm);
+        const uint64_t target = label_at(label);
+        if (!piece.is_long) {
+            m_code.push_back(inst.op == MOp::jmp ? 0xEB : inst.op == MOp::jz ? 0x74 : 0x75);
+            put(m_code, target - (size() + 1), 1);
+            continue;
+        }
+        if (inst.op == MOp::jmp) {
+            m_code.push_back(0xE9);
+        } else {
+            m_code.push_back(0x0F);
+            m_code.push_back(inst.op == MOp::jz ? 0x84 : 0x85);
+        }
+        if (target == k_unknown) m_fixups.push_back({.at = size(), .label = label});
+        put(m_code, target == k_unknown ? 0 : target - (size() + 4), 4);
+    }
+
+    std::erase_if(m_fixups, [&](const Fixup& fixup){
+        const uint64_t target = label_at(fixup.label);
+        if (target == k_unknown) return false;
+        const uint64_t distance = target - (fixup.at + 4);
+        for (int i = 0; i < 4; ++i) m_code[fixup.at - m_base + i] = static_cast<uint8_t>(distance >> (8 * i));
+        return true;
+    });
+}
+
+size_t Encoder::finished() const {
+    uint64_t end = size();
+    for (const Fixup& fixup : m_fixups) end = std::min(end, fixup.at);
+    return static_cast<size_t>(end - m_base);
+}
+
+void Encoder::drop(size_t count){
+    m_code.erase(m_code.begin(), m_code.begin() + static_cast<std::ptrdiff_t>(count));
+    m_base += count;
+}
+
+void Encoder::flush(ElfWriter& out){
+    const size_t count = finished();
+    out.write(std::span(m_code).first(count));
+    drop(count);
+}
+
+void Encoder::flush(JitBuffer& out){
+    const size_t count = finished();
+    out.write(std::span(m_code).first(count));
+    drop(count);
+}
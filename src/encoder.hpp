@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "machine.hpp"
+
+class ElfWriter;
+class JitBuffer;
+
+// Encodes machine instructions into x86-64 machine code. A jump is short
+// when its target is close enough: all jumps of a batch start short and the
+// ones that do not reach are grown until nothing changes. A jump to a label
+// that has not been seen yet gets a 32-bit displacement, filled in once the
+// label turns up in a later batch.
+class Encoder{
+public:
+    void encode(std::span<const MInst> code);
+
+    // Moves the finished code to out: everything before the first jump
+    // whose target is still unknown.
+    void flush(ElfWriter& out);
+    void flush(JitBuffer& out);
+
+    // bytes encoded so far
+    uint64_t size() const {
+        return m_base + m_code.size();
+    }
+private:
+    struct Fixup{
+        uint64_t at;        // of the rel32 field, from the start of the code
+        uint32_t label;
+    };
+
+    // an instruction of the current batch: encoded bytes in m_scratch, a
+    // jump or a label
+    struct Piece{
+        uint32_t begin;
+        uint32_t end;
+        uint32_t inst;
+        bool is_long;
+    };
+
+    // bytes at the front of m_code that no fixup will change any more
+    size_t finished() const;
+    void drop(size_t count);
+
+    uint64_t label_at(uint32_t label) const {
+        return label < m_labels.size() ? m_labels[label] : k_unknown;
+    }
+
+    static constexpr uint64_t k_unknown = UINT64_MAX;
+
+    std::vector<uint8_t> m_code;    // not flushed yet
+    uint64_t m_base = 0;            // offset of m_code[0]
+    std::vector<uint64_t> m_labels; // by label number
+    std::vector<Fixup> m_fixups;
+    std::vector<uint8_t> m_scratch;
+    std::vector<Piece> m_pieces;
+    std::vector<uint64_t> m_offsets;
+};
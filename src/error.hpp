@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// Raised for anything wrong with the program being compiled (or its file).
+// The driver reports the message; nothing is printed at the throw site.
+class CompileError : public std::runtime_error{
+public:
+    explicit CompileError(const std::string& msg) : std::runtime_error(msg) {}
+};
@@ -1,216 +1,494 @@
 #include "generation.hpp"
 #include <algorithm>
-#include <cstdlib>
-#include <iostream>
+#include <bit>
+#include <functional>
+#include <queue>
+#include "output.hpp"
 
-Generator::Generator(nodeProg prog) : m_prog(std::move(prog)) {}
+// callee-saved registers the allocator may hand out
+static constexpr Reg k_saved[] = {Reg::rbx, Reg::rbp, Reg::r12, Reg::r13, Reg::r14, Reg::r15};
 
-void Generator::gen_term(const nodeTerm* term){
-    struct TermVisitor{
-        Generator& gen;
-        void operator() (const nodeTermIntLit* term_int_lit) const{
-            gen.m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << '\n';
-            gen.push("rax");
-        }
-        void operator() (const nodeTermIdent* term_ident) const{
-            auto it = std::find_if(
-                    gen.m_vars.cbegin(),
-                    gen.m_vars.cend(),
-                    [&](const Var& var) { return var.name == term_ident->ident.value.value(); }); // it - iterator
-            if (it == gen.m_vars.cend()) {
-                std::cerr << "undefined identifier: " << term_ident->ident.value.value() << '\n';
-                exit(EXIT_FAILURE);
-            }
-            std::stringstream offset;
-            offset << "QWORD [rsp + " << (gen.m_stack_size - (*it).stack_loc - 1) * 8 << "]";
-            gen.push(offset.str());
-        }
-        void operator() (const nodeTermParen* term_paren) const{
-            gen.gen_expr(term_paren->expr);
-        }
+void Generator::begin_prog(){
+    m_header = true;
+    if (m_in_process) {
+        for (const Reg reg : k_saved) emit(MOp::push, reg_op(reg));
+    }
+}
+
+void Generator::end_prog(){
+    // falling off the end exits with 0, unless that is unreachable
+    if (m_falls_through) {
+        gen_exit(imm_op(0), m_slots);
+        m_optimized = false;
+    }
+    m_finished = true;
+}
+
+// frame: the slots below the stack pointer the program started with
+void Generator::gen_exit(const MOperand& value, uint32_t frame){
+    if (!m_in_process) {
+        mov(reg_op(Reg::rdi), value);
+        emit(MOp::mov, reg_op(Reg::rax), imm_op(60));
+        emit(MOp::syscall);
+        return;
+    }
+    mov(reg_op(Reg::rax), value);
+    if (frame) emit(MOp::add, reg_op(Reg::rsp), imm_op(8 * frame));
+    for (auto reg = std::rbegin(k_saved); reg != std::rend(k_saved); ++reg) emit(MOp::pop, reg_op(*reg));
+    emit(MOp::ret);
+}
+
+void Generator::optimize(){
+    if (m_peephole && !m_optimized) m_peephole->run(m_code);
+    m_optimized = true;
+}
+
+size_t Generator::ready() const {
+    const size_t keep = m_finished || !m_peephole ? 0 : std::min<size_t>(m_code.size(), 1);
+    return m_code.size() - keep;
+}
+
+void Generator::flush(OutputBuffer& out){
+    optimize();
+    if (m_header) {
+        out << "global _start\n_start:\n";
+        m_header = false;
+    }
+    const size_t count = ready();
+    print_nasm(std::span(m_code).first(count), out);
+    m_code.erase(m_code.begin(), m_code.begin() + static_cast<std::ptrdiff_t>(count));
+}
+
+// the entry point is the start of the code, no header needed
+void Generator::flush(Encoder& out){
+    optimize();
+    m_header = false;
+    const size_t count = ready();
+    out.encode(std::span(m_code).first(count));
+    m_code.erase(m_code.begin(), m_code.begin() + static_cast<std::ptrdiff_t>(count));
+}
+
+// Instruction i of the layout uses its operands at 2i and defines its
+// result at 2i + 1, so a value whose last use is i can hand its register
+// to i's result. Phis are defined together at the top of their block and
+// their arguments are used at the end of each predecessor.
+//
+// A branch on the eq right before it reads the flags of its cmp. When the
+// branch is the eq's only use, the 0/1 value is not materialized at all
+// and never gets a register.
+void Generator::allocate(const IrFunction& fn){
+    const size_t count = fn.vreg_count;
+    m_reg.assign(count, Reg::none);
+    m_spill.assign(count, 0);
+    m_is_const.assign(count, 0);
+    m_const.assign(count, 0);
+    m_sets_flags.assign(count, 0);
+    m_fused.assign(count, 0);
+    std::vector<uint32_t> start(count, UINT32_MAX);
+    std::vector<uint32_t> end(count, 0);
+    std::vector<uint32_t> uses(count, 0);
+    std::vector<uint32_t> block_end(fn.blocks.size(), 0);
+    std::vector<VReg> conditions;
+    const auto use = [&](VReg v, uint32_t pos){
+        end[v] = std::max(end[v], pos);
+        uses[v]++;
     };
-    TermVisitor visitor{.gen = *this};
-    std::visit(visitor, term->var);
-}
-
-void Generator::gen_bin_expr(const nodeBinExpr* bin_expr)
-{
-    struct ExprVisitor{
-        Generator& gen;
-        void operator() (const nodeBinExprSub* sub) const{
-            gen.gen_expr(sub->rhs);
-            gen.gen_expr(sub->lhs);
-            gen.pop("rbx");
-            gen.pop("rax");
-            gen.m_output << "    sub rbx, rax\n";
-            gen.push("rbx");
-        }
-        void operator() (const nodeBinExprAdd* add) const{
-            gen.gen_expr(add->rhs);
-            gen.gen_expr(add->lhs);
-            gen.pop("rax");
-            gen.pop("rbx");
-            gen.m_output << "    add rbx, rax\n";
-            gen.push("rbx");
+
+    uint32_t index = 0;
+    for (BlockId id = 0; id < fn.blocks.size(); ++id){
+        const IrBlock& block = fn.blocks[id];
+        if (block.dead) continue;
+        const uint32_t first = index;
+        uint32_t last_phi = first;
+        while (last_phi - first < block.insts.size() && block.insts[last_phi - first].op == IrOp::phi) ++last_phi;
+        const IrInst* last = nullptr;     // that generates code
+        for (const IrInst& inst : block.insts){
+            const uint32_t pos = 2 * index++;
+            if (inst.op == IrOp::branch && last && last->op == IrOp::eq && last->dst == inst.a) conditions.push_back(inst.a);
+            if (inst.op != IrOp::const_) last = &inst;
+            switch (inst.op){
+                case IrOp::const_:
+                    m_is_const[inst.dst] = 1;
+                    m_const[inst.dst] = inst.imm;
+                    continue;
+                case IrOp::phi: {
+                    start[inst.dst] = 2 * first + 1;
+                    use(inst.dst, 2 * last_phi + 1);
+                    const std::span<const VReg> args = fn.args(inst);
+                    for (size_t k = 0; k < args.size(); ++k) use(args[k], 2 * block_end[block.preds[k]]);
+                    continue;
+                }
+                case IrOp::store:
+                case IrOp::exit:
+                case IrOp::branch:
+                    use(inst.a, pos);
+                    break;
+                default:
+                    if (is_binary(inst.op)) {
+                        use(inst.a, pos);
+                        use(inst.b, pos);
+                    }
+                    break;
+            }
+            if (inst.dst != k_no_vreg) start[inst.dst] = pos + 1;
         }
-        void operator() (const nodeBinExprMulti* multi) const{
-            gen.gen_expr(multi->rhs);
-            gen.gen_expr(multi->lhs);
-            gen.pop("rax");
-            gen.pop("rbx");
-            gen.m_output << "    mul rbx\n";
-            gen.push("rax");
+        block_end[id] = index - 1;
+    }
+    for (const VReg v : conditions){
+        m_sets_flags[v] = 1;
+        if (uses[v] == 1) m_fused[v] = 1;
+    }
+
+    std::vector<LiveInterval> intervals;
+    for (VReg v = 0; v < count; ++v){
+        if (start[v] == UINT32_MAX || m_is_const[v] || m_fused[v]) continue;
+        intervals.push_back({.start = start[v], .end = std::max(start[v], end[v]), .owner = v});
+    }
+    std::sort(intervals.begin(), intervals.end(), [](const LiveInterval& a, const LiveInterval& b){ return a.start < b.start; });
+    const std::vector<Reg> regs = LinearScan(k_alloc_regs).run(intervals);
+
+    // spilled values share frame slots when their intervals do not overlap
+    using Busy = std::pair<uint32_t, uint32_t>;    // (end, slot)
+    std::priority_queue<Busy, std::vector<Busy>, std::greater<Busy>> busy;
+    std::vector<uint32_t> free_slots;
+    m_frame = 0;
+    for (size_t i = 0; i < intervals.size(); ++i){
+        const VReg v = intervals[i].owner;
+        m_reg[v] = regs[i];
+        if (regs[i] != Reg::none) continue;
+        while (!busy.empty() && busy.top().first < intervals[i].start){
+            free_slots.push_back(busy.top().second);
+            busy.pop();
         }
-        void operator() (const nodeBinExprDiv* div) const{
-            gen.gen_expr(div->rhs);
-            gen.gen_expr(div->lhs);
-            gen.pop("rax");
-            gen.pop("rbx");
-            gen.m_output << "    div rbx\n";
-            gen.push("rax");
+        uint32_t slot = m_frame;
+        if (free_slots.empty()) {
+            ++m_frame;
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
         }
-        void operator() (const nodeBinExprEq* eq) const{
-            gen.gen_expr(eq->rhs);
-            gen.gen_expr(eq->lhs);
+        m_spill[v] = slot;
+        busy.emplace(intervals[i].end, slot);
+    }
+}
 
-            gen.pop("rbx");
-            gen.pop("rax");
+MOperand Generator::operand(VReg vreg) const {
+    if (m_is_const[vreg]) return imm_op(m_const[vreg]);
+    if (m_reg[vreg] != Reg::none) return reg_op(m_reg[vreg]);
+    return mem_op(8 * m_spill[vreg]);
+}
 
-            gen.m_output << "    cmp rbx, rax\n";
-            gen.m_output << "    sete al\n";
-            gen.m_output << "    movzx rax, al\n";
+// top-level slots sit above the frame, the oldest one highest
+MOperand Generator::slot_operand(uint64_t slot) const {
+    return mem_op(static_cast<uint32_t>(8 * (m_frame + m_slots - 1 - slot)));
+}
 
-            gen.push("rax");
-        }
-    };
-    ExprVisitor visitor{.gen = *this};
-    std::visit(visitor, bin_expr->var);
+MOperand Generator::source(const MOperand& src){
+    if (src.is_wide_imm()) {
+        emit(MOp::mov, reg_op(Reg::r11), src);
+        return reg_op(Reg::r11);
+    }
+    return src;
 }
 
-void Generator::gen_expr(const nodeExpr* expr)
-{
-    struct ExprVisitor{
-        Generator& gen;
-        void operator() (const nodeTerm* term){
-            gen.gen_term(term);
-        }
-        void operator() (const nodeBinExpr* bin_expr) const{
-            gen.gen_bin_expr(bin_expr);
-        }
-    };
-    ExprVisitor visitor{.gen = *this};
-    std::visit(visitor, expr->var);
-}
-
-void Generator::gen_scope(const nodeScope* scope){
-    begin_scope();
-    for (const nodeStmt* stmt: scope->stmts){
-        gen_stmt(stmt);
-    }
-    end_scope();
-}
-
-void Generator::gen_if_pred(const nodeIfPred* pred, const std::string& end_label){  // end_label is a place where we should "jump" when we pass through if, elif and else
-    struct predVisitor{
-        Generator& gen;
-        const std::string& end_label;
-        void operator() (const nodeIfPredElif* elif) const {
-            gen.gen_expr(elif->expr);
-            gen.pop("rax");
-            std::string label = gen.create_label();
-            gen.m_output << "    test rax, rax\n";
-            gen.m_output << "    jz" << label << '\n';
-            gen.gen_scope(elif->scope);
-            gen.m_output << "    jmp " << end_label << '\n';
-            if (elif->pred.has_value()){
-                gen.m_output << label << ":\n";
-                gen.gen_if_pred(elif->pred.value(), end_label);
+void Generator::mov(const MOperand& dst, const MOperand& src){
+    if (dst == src) return;
+    if (dst.is_mem() && (src.is_mem() || src.is_wide_imm())) {
+        emit(MOp::mov, reg_op(Reg::rax), src);
+        emit(MOp::mov, dst, reg_op(Reg::rax));
+        return;
+    }
+    emit(MOp::mov, dst, src);
+}
+
+void Generator::gen_binary(const IrInst& inst){
+    const MOperand dst = operand(inst.dst);
+    const MOperand lhs = operand(inst.a);
+    const MOperand rhs = operand(inst.b);
+    const MOperand rax = reg_op(Reg::rax);
+    switch (inst.op){
+        case IrOp::add:
+        case IrOp::sub:
+        case IrOp::mul: {
+            if (inst.op == IrOp::mul && rhs.is_imm() && gen_mul_const(dst, lhs, rhs.imm)) break;
+            if (inst.op == IrOp::mul && lhs.is_imm() && gen_mul_const(dst, rhs, lhs.imm)) break;
+            // the low half of the product does not depend on signedness
+            const MOp op = inst.op == IrOp::add ? MOp::add : inst.op == IrOp::sub ? MOp::sub : MOp::imul;
+            if (!dst.is_reg()) {
+                mov(rax, lhs);
+                emit(op, rax, source(rhs));
+                mov(dst, rax);
+            } else if (rhs == dst && !(lhs == dst)) {
+                if (inst.op != IrOp::sub) {
+                    emit(op, dst, source(lhs));
+                } else {
+                    mov(rax, lhs);
+                    emit(MOp::sub, rax, rhs);
+                    mov(dst, rax);
+                }
+            } else {
+                mov(dst, lhs);
+                emit(op, dst, source(rhs));
             }
+            break;
         }
-        void operator() (const nodeIfPredElse* else_) const {
-            gen.gen_scope(else_->scope);
-        }
-    };
-    predVisitor visitor{.gen = *this, .end_label = end_label};
-    std::visit(visitor, pred->var);
-}
-
-void Generator::gen_stmt(const nodeStmt* stmt)
-{
-    struct StmtVisitor{
-        Generator& gen;
-        void operator() (const nodeStmtExit* stmt_exit) const {
-            gen.gen_expr(stmt_exit->expr);
-            gen.m_output << "    mov rax, 60\n";
-            gen.pop("rdi");
-            gen.m_output << "    syscall\n";
-        }
-        void operator() (const nodeStmtLet* stmt_let){
-            auto it = std::find_if(
-                    gen.m_vars.cbegin(),
-                    gen.m_vars.cend(),
-                    [&](const Var& var) { return var.name == stmt_let->ident.value.value(); });
-            if (it != gen.m_vars.cend()) {
-                std::cerr << "identifier already used: " << stmt_let->ident.value.value() << '\n';
-                exit(EXIT_FAILURE);
+        case IrOp::div: {
+            // division by zero has to trap like it does at -O0
+            if (rhs.is_imm() && rhs.imm != 0) {
+                gen_div_const(dst, lhs, rhs.imm);
+                break;
+            }
+            mov(rax, lhs);
+            emit(MOp::xor_, reg_op(Reg::rdx, 4), reg_op(Reg::rdx, 4));
+            if (rhs.is_imm()) {
+                emit(MOp::mov, reg_op(Reg::r11), rhs);
+                emit(MOp::div, reg_op(Reg::r11));
+            } else {
+                emit(MOp::div, rhs);
             }
-            gen.m_vars.push_back({ .name = stmt_let->ident.value.value(), .stack_loc = gen.m_stack_size });
-            gen.gen_expr(stmt_let->expr);
+            mov(dst, rax);
+            break;
         }
-
-        void operator() (const nodeStmtAssign* assign) const {
-            auto it = std::find_if(gen.m_vars.begin(), gen.m_vars.end(), [&](const Var& var){
-                return (var.name == assign->ident.value.value());
-            });
-            if (it == gen.m_vars.cend()){
-                std::cerr << "undefined variable: " << assign->ident.value.value() << '\n';
-                exit(EXIT_FAILURE);
+        case IrOp::eq: {
+            MOperand cmp_lhs = lhs;
+            if (!lhs.is_reg()) {
+                mov(rax, lhs);
+                cmp_lhs = rax;
+            }
+            emit(MOp::cmp, cmp_lhs, source(rhs));
+            if (m_fused[inst.dst]) break;
+            emit(MOp::sete, reg_op(Reg::rax, 1));
+            if (dst.is_reg()) {
+                emit(MOp::movzx, dst, reg_op(Reg::rax, 1));
+            } else {
+                emit(MOp::movzx, reg_op(Reg::rax, 4), reg_op(Reg::rax, 1));
+                mov(dst, rax);
             }
-            gen.gen_expr(assign->expr);
-            gen.pop("rax");
-            gen.m_output << "    mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
+            break;
+        }
+        default:
+            break;
+    }
+}
 
+// x * factor with a shift and/or a lea, for the factors where that is no
+// longer than imul: 0, 1, 2^k and {3, 5, 9} * 2^k.
+bool Generator::gen_mul_const(const MOperand& dst, const MOperand& x, uint64_t factor){
+    if (factor <= 1) {
+        mov(dst, factor ? x : imm_op(0));
+        return true;
+    }
+    const int shift = std::countr_zero(factor);
+    const uint64_t odd = factor >> shift;
+    if (odd != 1 && odd != 3 && odd != 5 && odd != 9) return false;
+    const MOperand work = dst.is_reg() ? dst : reg_op(Reg::rax);
+    if (odd == 1) {
+        mov(work, x);
+    } else {
+        Reg base = x.reg;
+        if (!x.is_reg()) {
+            mov(work, x);
+            base = work.reg;
         }
+        emit(MOp::lea, work, addr_op(base, base, static_cast<uint8_t>(odd - 1)));
+    }
+    if (shift) emit(MOp::shl, work, imm_op(static_cast<uint64_t>(shift)));
+    mov(dst, work);
+    return true;
+}
+
+// Granlund and Montgomery, as in libdivide: n / d is the high half of
+// (n >> pre_shift) * multiplier shifted right, exact for every 64-bit n.
+// When the multiplier would need 65 bits, add is set and the missing top
+// bit is added back with ((n - q) >> 1) + q; even divisors avoid that by
+// dividing n and d by their common power of two first.
+struct Magic{
+    uint64_t multiplier;
+    uint8_t shift;
+    uint8_t pre_shift;
+    bool add;
+};
 
-        void operator() (const nodeScope* scope) const{
-            gen.gen_scope(scope);
+static Magic unsigned_magic(uint64_t divisor){
+    const int log = 63 - std::countl_zero(divisor);
+    const unsigned __int128 power = static_cast<unsigned __int128>(1) << (64 + log);
+    uint64_t multiplier = static_cast<uint64_t>(power / divisor);
+    const uint64_t rem = static_cast<uint64_t>(power % divisor);
+    if (divisor - rem < uint64_t{1} << log) {
+        return {.multiplier = multiplier + 1, .shift = static_cast<uint8_t>(log), .pre_shift = 0, .add = false};
+    }
+    if (divisor % 2 == 0) {
+        // n >> zeros has at most 64 - zeros bits, so 63 + ceil(log2(odd))
+        // bits of precision are enough and the multiplier fits
+        const int zeros = std::countr_zero(divisor);
+        const uint64_t odd = divisor >> zeros;
+        const int odd_log = 64 - std::countl_zero(odd - 1);
+        const unsigned __int128 odd_power = static_cast<unsigned __int128>(1) << (63 + odd_log);
+        return {.multiplier = static_cast<uint64_t>((odd_power + odd - 1) / odd), .shift = static_cast<uint8_t>(odd_log - 1),
+                .pre_shift = static_cast<uint8_t>(zeros), .add = false};
+    }
+    multiplier += multiplier;
+    const uint64_t twice_rem = rem + rem;
+    if (twice_rem >= divisor || twice_rem < rem) multiplier += 1;
+    return {.multiplier = multiplier + 1, .shift = static_cast<uint8_t>(log), .pre_shift = 0, .add = true};
+}
+
+// x / divisor for a divisor other than 0, without div: a shift for powers
+// of two, a multiply by the reciprocal otherwise.
+void Generator::gen_div_const(const MOperand& dst, const MOperand& x, uint64_t divisor){
+    const MOperand rax = reg_op(Reg::rax);
+    const MOperand rdx = reg_op(Reg::rdx);
+    if (divisor == 1) {
+        mov(dst, x);
+        return;
+    }
+    if (std::has_single_bit(divisor)) {
+        const MOperand work = dst.is_reg() ? dst : rax;
+        mov(work, x);
+        emit(MOp::shr, work, imm_op(static_cast<uint64_t>(std::countr_zero(divisor))));
+        mov(dst, work);
+        return;
+    }
+    const Magic magic = unsigned_magic(divisor);
+    if (magic.pre_shift) {
+        const MOperand r11 = reg_op(Reg::r11);
+        mov(rax, x);
+        emit(MOp::shr, rax, imm_op(magic.pre_shift));
+        emit(MOp::mov, r11, imm_op(magic.multiplier));
+        emit(MOp::mul, r11);
+        emit(MOp::shr, rdx, imm_op(magic.shift));
+        mov(dst, rdx);
+        return;
+    }
+    MOperand n = x;
+    if (n.is_imm()) {
+        n = reg_op(Reg::r11);
+        emit(MOp::mov, n, x);
+    }
+    emit(MOp::mov, rax, imm_op(magic.multiplier));
+    emit(MOp::mul, n);
+    if (!magic.add) {
+        emit(MOp::shr, rdx, imm_op(magic.shift));
+        mov(dst, rdx);
+        return;
+    }
+    mov(rax, n);
+    emit(MOp::sub, rax, rdx);
+    emit(MOp::shr, rax, imm_op(1));
+    emit(MOp::add, rax, rdx);
+    emit(MOp::shr, rax, imm_op(magic.shift));
+    mov(dst, rax);
+}
+
+void Generator::gen_inst(const IrFunction& fn, BlockId block, const IrInst& inst){
+    switch (inst.op){
+        case IrOp::const_:
+        case IrOp::phi:
+            break;
+        case IrOp::load:
+            mov(operand(inst.dst), slot_operand(inst.imm));
+            break;
+        case IrOp::store:
+            mov(slot_operand(inst.imm), operand(inst.a));
+            break;
+        case IrOp::jump: {
+            const BlockId target = static_cast<BlockId>(inst.imm);
+            gen_phi_moves(fn, block, target);
+            if (target != m_next) emit(MOp::jmp, label(target));
+            break;
         }
-        void operator() (const nodeStmtIf* stmt_if) const{
-            gen.gen_expr(stmt_if->expr);
-            gen.pop("rax");
-            std::string label = gen.create_label();
-            gen.m_output << "    test rax, rax\n";
-            gen.m_output << "    jz " << label << '\n';
-            gen.gen_scope(stmt_if->scope);
-            std::optional<std::string> end_label;
-            if (stmt_if->pred.has_value()) {
-                end_label = gen.create_label();
-                gen.m_output << "    jmp " << end_label.value() << '\n';
-                gen.m_output << label << ":\n";
-                gen.gen_if_pred(stmt_if->pred.value(), end_label.value());
-                gen.m_output << end_label.value() << ":\n";
+        case IrOp::branch: {
+            const MOperand cond = operand(inst.a);
+            const BlockId then_block = static_cast<BlockId>(inst.imm);
+            const BlockId else_block = inst.b;
+            if (cond.is_imm()) {
+                const BlockId target = cond.imm ? then_block : else_block;
+                if (target != m_next) emit(MOp::jmp, label(target));
+                break;
             }
-            else{
-                gen.m_output << label << ":\n";
+            // ZF is set when the condition is false, or when an eq has
+            // just compared equal
+            const bool fused = m_sets_flags[inst.a];
+            if (!fused && cond.is_reg()) {
+                emit(MOp::test, cond, cond);
+            } else if (!fused) {
+                emit(MOp::cmp, cond, imm_op(0));
             }
-            gen.m_output << "    ;; /if\n";
+            const MOp to_else = fused ? MOp::jnz : MOp::jz;
+            const MOp to_then = fused ? MOp::jz : MOp::jnz;
+            if (then_block == m_next) {
+                emit(to_else, label(else_block));
+            } else if (else_block == m_next) {
+                emit(to_then, label(then_block));
+            } else {
+                emit(to_else, label(else_block));
+                emit(MOp::jmp, label(then_block));
+            }
+            break;
         }
-    };
+        case IrOp::exit:
+            gen_exit(operand(inst.a), m_slots + m_frame);
+            break;
+        case IrOp::ret:
+            if (m_frame) emit(MOp::add, reg_op(Reg::rsp), imm_op(8 * m_frame));
+            m_falls_through = true;
+            break;
+        default:
+            gen_binary(inst);
+            break;
+    }
+}
+void Generator::gen_phi_moves(const IrFunction& fn, BlockId from, BlockId to){
+    const IrBlock& target = fn.blocks[to];
+    const size_t column = static_cast<size_t>(std::find(target.preds.begin(), target.preds.end(), from) - target.preds.begin());
+    std::vector<Move> moves;
+    for (const IrInst& inst : target.insts){
+        if (inst.op != IrOp::phi) break;
+        moves.push_back({.dst = operand(inst.dst), .src = operand(fn.args(inst)[column])});
+    }
+    gen_parallel_moves(moves);
+}
 
-    StmtVisitor visitor{.gen = *this};
-    std::visit(visitor, stmt->var);
+// Emits moves so that every destination gets the value its source had
+// before any of them. rax is taken by mov() for memory to memory copies,
+// so cycles are broken through rdx.
+void Generator::gen_parallel_moves(std::vector<Move>& moves){
+    std::erase_if(moves, [](const Move& m){ return m.dst == m.src; });
+    while (!moves.empty()){
+        const auto ready = std::find_if(moves.begin(), moves.end(), [&](const Move& m){
+            return std::none_of(moves.begin(), moves.end(), [&](const Move& other){ return other.src == m.dst; });
+        });
+        if (ready != moves.end()) {
+            mov(ready->dst, ready->src);
+            moves.erase(ready);
+            continue;
+        }
+        // only cycles are left: park one destination's value in rdx
+        const MOperand parked = moves.front().dst;
+        const MOperand rdx = reg_op(Reg::rdx);
+        mov(rdx, parked);
+        for (Move& m : moves){
+            if (m.src == parked) m.src = rdx;
+        }
+    }
 }
 
-std::string Generator::gen_prog()
-{
-    m_output << "global _start\n_start:\n";
+void Generator::gen_function(const IrFunction& fn){
+    allocate(fn);
+    m_slots = fn.slot_base + fn.new_slots;
+    m_falls_through = false;
+    m_optimized = false;
+    if (m_frame + fn.new_slots) emit(MOp::sub, reg_op(Reg::rsp), imm_op(8 * (m_frame + fn.new_slots)));
 
-    for (const nodeStmt* stmt : m_prog.stmts){
-        gen_stmt(stmt);
+    for (BlockId id = 0; id < fn.blocks.size(); ++id){
+        const IrBlock& block = fn.blocks[id];
+        if (block.dead) continue;
+        m_next = id + 1;
+        while (m_next < fn.blocks.size() && fn.blocks[m_next].dead) ++m_next;
+        if (!block.preds.empty()) emit(MOp::label, label(id));
+        for (const IrInst& inst : block.insts){
+            gen_inst(fn, id, inst);
+        }
     }
-
-    m_output << "    mov rax, 60\n";
-    m_output << "    mov rdi, 0\n";
-    m_output << "    syscall\n";
-    return m_output.str();
+    m_label_base += static_cast<uint32_t>(fn.blocks.size());
 }
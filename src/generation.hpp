@@ -1,67 +1,98 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
-#include <algorithm>
-#include <cassert>
-#include <iostream>
-#include <sstream>
-#include "parser.hpp"
+#include "encoder.hpp"
+#include "ir.hpp"
+#include "machine.hpp"
+#include "peephole.hpp"
+#include "regalloc.hpp"
 
+// Lowers IR functions to x86-64. Vregs get registers by linear scan over
+// the block layout; the ones that do not fit are spilled to a frame below
+// the top-level slots, constants are folded into the instructions that use
+// them, and phis become parallel moves at the end of each predecessor. The
+// code is kept as machine instructions until it is flushed, which runs the
+// peephole pass over it and prints it as NASM.
+//
+// A program normally ends with the exit syscall. Code that is called in
+// this process instead saves the registers it must not clobber on entry,
+// and exit unwinds its stack and returns the value in rax.
 class Generator{
 public:
-    explicit Generator(nodeProg prog);
+    // without a peephole pass the code is printed as generated
+    explicit Generator(Peephole* peephole = nullptr, bool in_process = false)
+        : m_peephole(peephole), m_in_process(in_process) {}
 
-    void gen_term(const nodeTerm* term);
+    void begin_prog();
 
-    void gen_bin_expr(const nodeBinExpr* bin_expr);
+    // Appends the code for fn. Functions are laid out back to back, so one
+    // that ends in a ret falls through into the next.
+    void gen_function(const IrFunction& fn);
 
-    void gen_expr(const nodeExpr* expr);
+    void end_prog();
 
-    void gen_scope(const nodeScope* scope);
+    // Runs the peephole pass over the code generated so far.
+    void optimize();
 
-    void gen_if_pred(const nodeIfPred* pred, const std::string& end_label);
+    // Moves everything generated so far to out, as NASM text or encoded.
+    // Before end_prog() the last instruction is held back, so that the
+    // peephole pass can still pair it with the first one of the next
+    // function.
+    void flush(OutputBuffer& out);
+    void flush(Encoder& out);
+private:
+    struct Move{
+        MOperand dst;
+        MOperand src;
+    };
 
-    void gen_stmt(const nodeStmt* stmt);
+    // instructions flush() can hand out
+    size_t ready() const;
 
-    std::string gen_prog();
-private:
-    void push(const std::string& reg){
-        m_output << "    push " << reg << '\n';
-        m_stack_size++;
-    }
+    void allocate(const IrFunction& fn);
 
-    void pop(const std::string& reg){
-        m_output << "    pop " << reg << '\n';
-        m_stack_size--;
-    }
+    MOperand operand(VReg vreg) const;
+    MOperand slot_operand(uint64_t slot) const;
 
-    void begin_scope(){
-        m_scopes.push_back(m_vars.size());
+    void emit(MOp op, const MOperand& dst = {}, const MOperand& src = {}){
+        m_code.push_back({.op = op, .dst = dst, .src = src});
     }
 
-    void end_scope(){
-        size_t pop_count = m_vars.size() - m_scopes.back();
-        m_output << "    add rsp, " << pop_count * 8 << '\n';
-        m_stack_size -= pop_count;
-        for (size_t i = 0; i < pop_count; ++i) m_vars.pop_back();
-        m_scopes.pop_back();
-    }
+    // src as the second operand of an ALU instruction: 64-bit immediates
+    // are loaded into r11 first
+    MOperand source(const MOperand& src);
 
-    std::string create_label(){
-        std::stringstream ss;
-        ss << "label" << m_label_count++;
-        return ss.str();
+    void mov(const MOperand& dst, const MOperand& src);
+    void gen_binary(const IrInst& inst);
+    bool gen_mul_const(const MOperand& dst, const MOperand& x, uint64_t factor);
+    void gen_div_const(const MOperand& dst, const MOperand& x, uint64_t divisor);
+    void gen_inst(const IrFunction& fn, BlockId block, const IrInst& inst);
+    void gen_phi_moves(const IrFunction& fn, BlockId from, BlockId to);
+    void gen_parallel_moves(std::vector<Move>& moves);
+    void gen_exit(const MOperand& value, uint32_t frame);
+
+    MOperand label(BlockId block) const {
+        return label_op(m_label_base + block);
     }
 
-    struct Var{
-        std::string name;
-        size_t stack_loc;
-    };
+    Peephole* m_peephole;
+    bool m_in_process;
+    std::vector<MInst> m_code;
+    bool m_optimized = true;        // nothing new since the last peephole run
+    bool m_header = false;          // the program header is still to be printed
+    bool m_finished = false;
+    uint32_t m_label_base = 0;
+    bool m_falls_through = true;    // the last function ended in a ret
 
-    const nodeProg m_prog;
-    std::stringstream m_output;
-    size_t m_stack_size = 0;
-    std::vector<Var> m_vars {};
-    std::vector<size_t> m_scopes {};
-    int m_label_count = 0;
-};
\ No newline at end of file
+    // per function
+    std::vector<Reg> m_reg;         // by vreg; Reg::none if spilled or constant
+    std::vector<uint32_t> m_spill;  // by vreg: frame slot of a spilled vreg
+    std::vector<uint8_t> m_is_const;
+    std::vector<uint64_t> m_const;
+    std::vector<uint8_t> m_sets_flags;  // by vreg: an eq whose flags the next branch reads
+    std::vector<uint8_t> m_fused;       // by vreg: ... and nothing else uses it
+    uint32_t m_frame = 0;           // spill slots
+    uint32_t m_slots = 0;           // top-level slots above the frame
+    BlockId m_next = 0;             // block laid out after the current one
+};
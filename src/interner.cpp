@@ -0,0 +1,54 @@
+#include "interner.hpp"
+#include <algorithm>
+#include <cstring>
+
+static uint32_t hash_name(std::string_view name){
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ name.size();
+    const char* p = name.data();
+    size_t n = name.size();
+    for (; n >= 8; p += 8, n -= 8){
+        uint64_t chunk;
+        std::memcpy(&chunk, p, 8);
+        h = (h ^ chunk) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, p, n);
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ull;
+    return static_cast<uint32_t>(h ^ (h >> 29));
+}
+
+SymbolId Interner::intern(std::string_view name){
+    if ((m_size + 1) * 2 > m_slots.size()) grow();
+    const uint32_t hash = hash_name(name);
+    const size_t mask = m_slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask){
+        Slot& slot = m_slots[i];
+        if (slot.id == k_empty){
+            slot = {.hash = hash, .id = static_cast<SymbolId>(m_size)};
+            const auto [block, index] = locate(slot.id);
+            if (!m_names[block]) m_names[block] = std::make_unique_for_overwrite<std::string_view[]>(size_t{k_first_block} << block);
+            m_names[block][index] = name;
+            m_size++;
+            return slot.id;
+        }
+        if (slot.hash == hash && this->name(slot.id) == name) return slot.id;
+    }
+}
+
+void Interner::grow(){
+    std::vector<Slot> slots(m_slots.empty() ? 64 : m_slots.size() * 2, Slot{.hash = 0, .id = k_empty});
+    const size_t mask = slots.size() - 1;
+    for (const Slot& slot : m_slots){
+        if (slot.id == k_empty) continue;
+        size_t i = slot.hash & mask;
+        while (slots[i].id != k_empty) i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+    m_slots = std::move(slots);
+}
+
+void Interner::clear(){
+    m_size = 0;
+    std::fill(m_slots.begin(), m_slots.end(), Slot{.hash = 0, .id = k_empty});
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using SymbolId = uint32_t;
+
+// Maps identifier spellings to dense ids. Names are views into the source
+// buffer, so the buffer has to outlive the table.
+//
+// Names are stored in blocks that double in size and never move, so in a
+// pipelined compile another thread can look up the name of an id it was
+// handed while the lexer goes on interning.
+class Interner{
+public:
+    SymbolId intern(std::string_view name);
+
+    std::string_view name(SymbolId id) const {
+        const auto [block, index] = locate(id);
+        return m_names[block][index];
+    }
+
+    size_t size() const {
+        return m_size;
+    }
+
+    // Forgets every name but keeps the table's storage for reuse.
+    void clear();
+private:
+    // open addressing with linear probing; id == k_empty marks a free slot
+    struct Slot{
+        uint32_t hash;
+        SymbolId id;
+    };
+    static constexpr SymbolId k_empty = UINT32_MAX;
+
+    // block b holds k_first_block << b names, from id (2^b - 1) * k_first_block
+    static constexpr uint32_t k_first_block = 64;
+    static constexpr size_t k_blocks = 27;
+
+    static std::pair<size_t, size_t> locate(SymbolId id){
+        const size_t block = std::bit_width(id / k_first_block + 1) - 1;
+        return {block, id - ((size_t{1} << block) - 1) * k_first_block};
+    }
+
+    void grow();
+
+    std::array<std::unique_ptr<std::string_view[]>, k_blocks> m_names;
+    size_t m_size = 0;
+    std::vector<Slot> m_slots;
+};
@@ -0,0 +1,74 @@
+#include "interpreter.hpp"
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <vector>
+
+// Dies of SIGFPE like the native code does. A handler, SIG_IGN or a
+// blocked SIGFPE inherited from the parent would let raise() return, so
+// the default action is put back first; should the process still
+// survive, it exits with the status the shell reports for the signal.
+[[noreturn]] static void divide_by_zero(){
+    std::signal(SIGFPE, SIG_DFL);
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGFPE);
+    pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+    std::raise(SIGFPE);
+    std::_Exit(128 + SIGFPE);
+}
+
+uint64_t interpret(const Bytecode& program){
+    std::vector<uint64_t> registers(program.registers);
+    std::copy(program.constants.begin(), program.constants.end(), registers.begin());
+    uint64_t* const r = registers.data();
+    const BcInst* const code = program.code.data();
+    const BcInst* ip = code;
+
+    // in the order of BcOp
+    static constexpr void* handlers[k_bc_op_count] = {
+        &&op_mov, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_eq,
+        &&op_jmp, &&op_jz, &&op_jnz, &&op_jeq, &&op_jne, &&op_exit,
+    };
+#define DISPATCH() goto *handlers[static_cast<uint8_t>(ip->op)]
+#define NEXT() do { ++ip; DISPATCH(); } while (false)
+#define JUMP_IF(cond) do { ip = (cond) ? code + ip->dst : ip + 1; DISPATCH(); } while (false)
+
+    DISPATCH();
+op_mov:
+    r[ip->dst] = r[ip->a];
+    NEXT();
+op_add:
+    r[ip->dst] = r[ip->a] + r[ip->b];
+    NEXT();
+op_sub:
+    r[ip->dst] = r[ip->a] - r[ip->b];
+    NEXT();
+op_mul:
+    r[ip->dst] = r[ip->a] * r[ip->b];
+    NEXT();
+op_div:
+    if (r[ip->b] == 0) divide_by_zero();
+    r[ip->dst] = r[ip->a] / r[ip->b];
+    NEXT();
+op_eq:
+    r[ip->dst] = r[ip->a] == r[ip->b];
+    NEXT();
+op_jmp:
+    ip = code + ip->dst;
+    DISPATCH();
+op_jz:
+    JUMP_IF(r[ip->a] == 0);
+op_jnz:
+    JUMP_IF(r[ip->a] != 0);
+op_jeq:
+    JUMP_IF(r[ip->a] == r[ip->b]);
+op_jne:
+    JUMP_IF(r[ip->a] != r[ip->b]);
+op_exit:
+    return r[ip->a];
+
+#undef DISPATCH
+#undef NEXT
+#undef JUMP_IF
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+#include "bytecode.hpp"
+
+// Runs a bytecode program and returns the value it exits with. Dispatch is
+// direct-threaded: every handler jumps straight to the handler of the next
+// instruction through a table of label addresses (computed goto), instead
+// of going back to the top of a switch. Division by zero kills the process
+// with SIGFPE, as the native code would, whatever the SIGFPE disposition.
+uint64_t interpret(const Bytecode& program);
@@ -0,0 +1,109 @@
+#include "ir.hpp"
+#include "output.hpp"
+
+size_t IrFunction::successors(const IrBlock& block, BlockId out[2]) const {
+    // unreachable blocks are not always terminated
+    if (block.insts.empty()) return 0;
+    const IrInst& term = block.terminator();
+    switch (term.op){
+        case IrOp::jump:
+            out[0] = static_cast<BlockId>(term.imm);
+            return 1;
+        case IrOp::branch:
+            out[0] = static_cast<BlockId>(term.imm);
+            out[1] = term.b;
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+size_t IrFunction::inst_count() const {
+    size_t count = 0;
+    for (const IrBlock& block : blocks){
+        if (!block.dead) count += block.insts.size();
+    }
+    return count;
+}
+
+void IrFunction::clear(){
+    blocks.clear();
+    phi_args.clear();
+    vreg_count = 0;
+    slot_base = 0;
+    new_slots = 0;
+}
+
+static const char* op_name(IrOp op){
+    switch (op){
+        case IrOp::const_: return "const";
+        case IrOp::add: return "add";
+        case IrOp::sub: return "sub";
+        case IrOp::mul: return "mul";
+        case IrOp::div: return "div";
+        case IrOp::eq: return "eq";
+        case IrOp::phi: return "phi";
+        case IrOp::load: return "load";
+        case IrOp::store: return "store";
+        case IrOp::jump: return "jump";
+        case IrOp::branch: return "branch";
+        case IrOp::exit: return "exit";
+        case IrOp::ret: return "ret";
+    }
+    return "?";
+}
+
+void dump_ir(const IrFunction& fn, OutputBuffer& out){
+    if (fn.slot_base || fn.new_slots) {
+        out << "; slots " << fn.slot_base << " + " << fn.new_slots << '\n';
+    }
+    for (BlockId id = 0; id < fn.blocks.size(); ++id){
+        const IrBlock& block = fn.blocks[id];
+        if (block.dead) continue;
+        out << "b" << id << ":";
+        if (!block.preds.empty()) {
+            out << "  ; preds";
+            for (const BlockId pred : block.preds) out << " b" << pred;
+        }
+        out << '\n';
+        for (const IrInst& inst : block.insts){
+            out << "    ";
+            if (inst.dst != k_no_vreg) out << "%" << inst.dst << " = ";
+            out << op_name(inst.op);
+            switch (inst.op){
+                case IrOp::const_:
+                    out << ' ' << inst.imm;
+                    break;
+                case IrOp::phi: {
+                    const char* sep = " ";
+                    for (size_t i = 0; i < inst.b; ++i){
+                        out << sep << "[%" << fn.args(inst)[i] << ", b" << block.preds[i] << "]";
+                        sep = ", ";
+                    }
+                    break;
+                }
+                case IrOp::load:
+                    out << " slot" << inst.imm;
+                    break;
+                case IrOp::store:
+                    out << " slot" << inst.imm << ", %" << inst.a;
+                    break;
+                case IrOp::jump:
+                    out << " b" << inst.imm;
+                    break;
+                case IrOp::branch:
+                    out << " %" << inst.a << ", b" << inst.imm << ", b" << inst.b;
+                    break;
+                case IrOp::exit:
+                    out << " %" << inst.a;
+                    break;
+                case IrOp::ret:
+                    break;
+                default:
+                    out << " %" << inst.a << ", %" << inst.b;
+                    break;
+            }
+            out << '\n';
+        }
+    }
+}
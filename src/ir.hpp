@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+class OutputBuffer;
+
+// Mid-level IR: basic blocks of three-address instructions over virtual
+// registers in SSA form. Every vreg has exactly one definition, and values
+// that differ between the branches of an if meet in phis at the join.
+// Blocks are laid out so that every definition comes before its uses; the
+// language has no loops, so the layout is also a topological order.
+
+using VReg = uint32_t;
+using BlockId = uint32_t;
+
+inline constexpr VReg k_no_vreg = UINT32_MAX;
+
+enum class IrOp : uint8_t {
+    const_,     // dst = imm
+    add,        // dst = a + b
+    sub,        // dst = a - b
+    mul,        // dst = a * b
+    div,        // dst = a / b (unsigned)
+    eq,         // dst = a == b
+    phi,        // dst = one of phi_args[a, a + b), in the order of preds
+    load,       // dst = slot imm
+    store,      // slot imm = a
+    jump,       // goto block imm
+    branch,     // a != 0 ? block imm : block b
+    exit,       // exit(a)
+    ret,        // end of the function: fall through to what follows it
+};
+
+struct IrInst{
+    IrOp op;
+    VReg dst;
+    VReg a;
+    VReg b;
+    uint64_t imm;
+};
+
+inline bool is_terminator(IrOp op){
+    return op >= IrOp::jump;
+}
+
+inline bool is_binary(IrOp op){
+    return op >= IrOp::add && op <= IrOp::eq;
+}
+
+struct IrBlock{
+    std::vector<IrInst> insts;      // phis first, a terminator last
+    std::vector<BlockId> preds;
+    bool dead = false;              // unreachable, skipped by everything
+
+    const IrInst& terminator() const {
+        return insts.back();
+    }
+};
+
+// One unit of code generation: the whole program, or in streaming mode a
+// single top-level statement. Top-level variables of a streamed program
+// live in stack slots that outlive the function: slots [0, slot_base)
+// exist already, new_slots more are created by this one.
+struct IrFunction{
+    std::vector<IrBlock> blocks;
+    std::vector<VReg> phi_args;
+    uint32_t vreg_count = 0;
+    uint32_t slot_base = 0;
+    uint32_t new_slots = 0;
+
+    std::span<const VReg> args(const IrInst& phi) const {
+        return {phi_args.data() + phi.a, static_cast<size_t>(phi.b)};
+    }
+
+    // successors of a block, from its terminator
+    size_t successors(const IrBlock& block, BlockId out[2]) const;
+
+    size_t inst_count() const;
+
+    void clear();
+};
+
+void dump_ir(const IrFunction& fn, OutputBuffer& out);
@@ -0,0 +1,265 @@
+#include "ir_builder.hpp"
+#include "error.hpp"
+#include "regalloc.hpp"
+#include <algorithm>
+
+IrBuilder::IrBuilder(const Ast& ast, const Interner& interner) : m_ast(ast), m_interner(interner) {}
+
+void IrBuilder::build_prog(nodeProg prog, IrFunction& fn){
+    m_need = label_register_need(m_ast);
+    begin_function(fn);
+    for (const NodeId stmt : m_ast.list(prog.stmts)){
+        build_stmt(stmt);
+    }
+    end_function();
+}
+
+void IrBuilder::build_top_stmt(NodeId stmt, IrFunction& fn){
+    m_streaming = true;
+    // the tree may hold other statements too (a pipelined batch), so only
+    // this one's expressions are labelled
+    label_register_need(m_ast, stmt, m_need);
+    begin_function(fn);
+    build_stmt(stmt);
+    end_function();
+}
+
+void IrBuilder::begin_function(IrFunction& fn){
+    m_fn = &fn;
+    fn.clear();
+    fn.slot_base = m_slots;
+    m_env.clear();
+    m_log.clear();
+    m_arm_values.clear();
+    set_block(new_block());
+}
+
+void IrBuilder::end_function(){
+    if (reachable()) emit(IrOp::ret);
+    m_fn = nullptr;
+}
+
+VReg IrBuilder::emit(IrOp op, VReg a, VReg b, uint64_t imm){
+    IrBlock& block = m_fn->blocks[m_block];
+    const VReg dst = op < IrOp::store ? m_fn->vreg_count++ : k_no_vreg;
+    block.insts.push_back({.op = op, .dst = dst, .a = a, .b = b, .imm = imm});
+    if (!block.dead) {
+        if (op == IrOp::jump || op == IrOp::branch) m_fn->blocks[imm].preds.push_back(m_block);
+        if (op == IrOp::branch) m_fn->blocks[b].preds.push_back(m_block);
+    }
+    return dst;
+}
+
+BlockId IrBuilder::new_block(){
+    m_fn->blocks.emplace_back();
+    return static_cast<BlockId>(m_fn->blocks.size() - 1);
+}
+
+void IrBuilder::set_block(BlockId block){
+    m_block = block;
+    IrBlock& b = m_fn->blocks[block];
+    b.dead = block != 0 && b.preds.empty();
+}
+
+const IrBuilder::Binding& IrBuilder::lookup(SymbolId ident, const char* error) const {
+    const Binding* binding = m_names.find(ident);
+    if (!binding) {
+        throw CompileError(error + std::string(m_interner.name(ident)));
+    }
+    return *binding;
+}
+
+void IrBuilder::set_var(uint32_t var, VReg value){
+    if (m_if_depth > 0) m_log.emplace_back(var, m_env[var]);
+    m_env[var] = value;
+}
+
+void IrBuilder::undo_to(size_t mark){
+    while (m_log.size() > mark){
+        m_env[m_log.back().first] = m_log.back().second;
+        m_log.pop_back();
+    }
+}
+
+VReg IrBuilder::build_expr(NodeId expr){
+    const nodeExpr& node = m_ast.expr(expr);
+    switch (node.kind){
+        case ExprKind::int_lit:
+            return emit(IrOp::const_, k_no_vreg, k_no_vreg, m_ast.int_value(node));
+        case ExprKind::ident: {
+            const Binding& var = lookup(node.ident, "undefined identifier: ");
+            if (var.in_slot) return emit(IrOp::load, k_no_vreg, k_no_vreg, var.index);
+            return m_env[var.index];
+        }
+        default:
+            break;
+    }
+    // Sethi-Ullman order: the operand that needs more registers goes first
+    VReg lhs, rhs;
+    if (m_need[node.rhs] > m_need[node.lhs]) {
+        rhs = build_expr(node.rhs);
+        lhs = build_expr(node.lhs);
+    } else {
+        lhs = build_expr(node.lhs);
+        rhs = build_expr(node.rhs);
+    }
+    IrOp op = IrOp::eq;
+    switch (node.kind){
+        case ExprKind::add: op = IrOp::add; break;
+        case ExprKind::sub: op = IrOp::sub; break;
+        case ExprKind::multi: op = IrOp::mul; break;
+        case ExprKind::div: op = IrOp::div; break;
+        default: break;
+    }
+    return emit(op, lhs, rhs);
+}
+
+void IrBuilder::build_scope(StmtRange scope){
+    m_names.begin_scope();
+    ++m_depth;
+    for (const NodeId stmt : m_ast.list(scope)){
+        build_stmt(stmt);
+    }
+    --m_depth;
+    m_names.end_scope();
+}
+
+void IrBuilder::build_stmt(NodeId stmt){
+    const nodeStmt& node = m_ast.stmt(stmt);
+    switch (node.kind){
+        case StmtKind::exit:
+            emit(IrOp::exit, build_expr(node.expr));
+            // anything after it in this block is unreachable
+            set_block(new_block());
+            break;
+        case StmtKind::let: {
+            if (m_names.find(node.ident)) {
+                throw CompileError("identifier already used: " + std::string(m_interner.name(node.ident)));
+            }
+            const VReg value = build_expr(node.expr);
+            if (m_streaming && m_depth == 0) {
+                const uint32_t slot = m_slots++;
+                m_fn->new_slots++;
+                emit(IrOp::store, value, k_no_vreg, slot);
+                m_names.declare(node.ident, {.in_slot = true, .index = slot});
+            } else {
+                m_names.declare(node.ident, {.in_slot = false, .index = static_cast<uint32_t>(m_env.size())});
+                m_env.push_back(value);
+            }
+            break;
+        }
+        case StmtKind::assign: {
+            const Binding var = lookup(node.ident, "undefined variable: ");
+            const VReg value = build_expr(node.expr);
+            if (var.in_slot) emit(IrOp::store, value, k_no_vreg, var.index);
+            else set_var(var.index, value);
+            break;
+        }
+        case StmtKind::scope:
+            build_scope(node.scope);
+            break;
+        case StmtKind::if_:
+            build_if(node);
+            break;
+    }
+}
+
+// Collects the outer variables the arm just built has changed, then puts
+// their values back for the next arm.
+void IrBuilder::end_arm(size_t mark, size_t outer_vars, std::vector<Arm>& arms){
+    if (reachable()) {
+        Arm arm{.block = m_block, .first = static_cast<uint32_t>(m_arm_values.size()), .count = 0};
+        const uint32_t stamp = ++m_stamp;
+        for (size_t i = mark; i < m_log.size(); ++i){
+            const uint32_t var = m_log[i].first;
+            if (var >= outer_vars || m_seen[var] == stamp) continue;
+            m_seen[var] = stamp;
+            m_arm_values.emplace_back(var, m_env[var]);
+        }
+        arm.count = static_cast<uint32_t>(m_arm_values.size()) - arm.first;
+        arms.push_back(arm);
+    }
+    undo_to(mark);
+}
+
+void IrBuilder::build_if(const nodeStmt& node){
+    const size_t outer_vars = m_env.size();
+    if (m_seen.size() < outer_vars) {
+        m_seen.resize(outer_vars, 0);
+        m_phi_row.resize(outer_vars);
+    }
+    const size_t values_base = m_arm_values.size();
+    std::vector<Arm> arms;
+    ++m_if_depth;
+
+    VReg cond = build_expr(node.expr);
+    StmtRange scope = node.scope;
+    NodeId pred = node.pred;
+    while (true){
+        const BlockId then_block = new_block();
+        const BlockId next_block = new_block();
+        emit(IrOp::branch, cond, next_block, then_block);
+        set_block(then_block);
+        const size_t mark = m_log.size();
+        build_scope(scope);
+        end_arm(mark, outer_vars, arms);
+        set_block(next_block);
+
+        if (pred == k_no_node) {
+            // no else: falling through is an arm that changes nothing
+            end_arm(m_log.size(), outer_vars, arms);
+            break;
+        }
+        const nodeIfPred& branch = m_ast.pred(pred);
+        if (branch.kind == PredKind::else_) {
+            const size_t else_mark = m_log.size();
+            build_scope(branch.scope);
+            end_arm(else_mark, outer_vars, arms);
+            break;
+        }
+        cond = build_expr(branch.expr);
+        scope = branch.scope;
+        pred = branch.next;
+    }
+    --m_if_depth;
+
+    const BlockId join = new_block();
+    for (const Arm& arm : arms){
+        m_block = arm.block;
+        emit(IrOp::jump, k_no_vreg, k_no_vreg, join);
+    }
+    set_block(join);
+
+    // one row of phi arguments per changed variable, one column per arm
+    const uint32_t stamp = ++m_stamp;
+    m_phi_vars.clear();
+    for (size_t i = values_base; i < m_arm_values.size(); ++i){
+        const uint32_t var = m_arm_values[i].first;
+        if (m_seen[var] == stamp) continue;
+        m_seen[var] = stamp;
+        m_phi_vars.push_back(var);
+    }
+    const size_t columns = arms.size();
+    m_phi_values.resize(m_phi_vars.size() * columns);
+    for (size_t row = 0; row < m_phi_vars.size(); ++row){
+        std::fill_n(m_phi_values.begin() + static_cast<std::ptrdiff_t>(row * columns), columns, m_env[m_phi_vars[row]]);
+        m_phi_row[m_phi_vars[row]] = static_cast<uint32_t>(row);
+    }
+    for (size_t column = 0; column < columns; ++column){
+        for (uint32_t i = arms[column].first; i < arms[column].first + arms[column].count; ++i){
+            m_phi_values[m_phi_row[m_arm_values[i].first] * columns + column] = m_arm_values[i].second;
+        }
+    }
+    m_arm_values.resize(values_base);
+
+    for (size_t row = 0; row < m_phi_vars.size(); ++row){
+        const VReg* values = m_phi_values.data() + row * columns;
+        if (std::all_of(values, values + columns, [&](VReg v){ return v == values[0]; })) {
+            if (values[0] != m_env[m_phi_vars[row]]) set_var(m_phi_vars[row], values[0]);
+            continue;
+        }
+        const uint32_t first = static_cast<uint32_t>(m_fn->phi_args.size());
+        m_fn->phi_args.insert(m_fn->phi_args.end(), values, values + columns);
+        set_var(m_phi_vars[row], emit(IrOp::phi, first, static_cast<VReg>(columns)));
+    }
+}
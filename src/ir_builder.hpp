@@ -0,0 +1,80 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+#include "ast.hpp"
+#include "interner.hpp"
+#include "ir.hpp"
+#include "symbol_table.hpp"
+
+// Lowers the AST to SSA. Variables are tracked as the vreg that currently
+// holds their value; an if records which variables its branches changed
+// (through an undo log) and merges them with phis at the join. Name errors
+// are reported here.
+class IrBuilder{
+public:
+    IrBuilder(const Ast& ast, const Interner& interner);
+
+    void build_prog(nodeProg prog, IrFunction& fn);
+
+    // Streaming mode: builds one top-level statement. Top-level variables
+    // are kept in stack slots, since later statements still refer to them.
+    void build_top_stmt(NodeId stmt, IrFunction& fn);
+private:
+    struct Binding{
+        bool in_slot;
+        uint32_t index;     // into m_env, or the slot number
+    };
+
+    // a branch of an if that reaches the join, with the values it changed
+    struct Arm{
+        BlockId block;
+        uint32_t first;     // into m_arm_values
+        uint32_t count;
+    };
+
+    void begin_function(IrFunction& fn);
+    void end_function();
+
+    // Appends to the current block; returns the new vreg for instructions
+    // that produce a value. Terminators also register the block as a
+    // predecessor of their targets, unless it is unreachable.
+    VReg emit(IrOp op, VReg a = k_no_vreg, VReg b = k_no_vreg, uint64_t imm = 0);
+    BlockId new_block();
+    // Blocks without predecessors (after an exit) are unreachable; code in
+    // them is still built so that it gets checked.
+    void set_block(BlockId block);
+
+    bool reachable() const {
+        return !m_fn->blocks[m_block].dead;
+    }
+
+    VReg build_expr(NodeId expr);
+    void build_stmt(NodeId stmt);
+    void build_scope(StmtRange scope);
+    void build_if(const nodeStmt& node);
+    void end_arm(size_t mark, size_t outer_vars, std::vector<Arm>& arms);
+
+    const Binding& lookup(SymbolId ident, const char* error) const;
+    void set_var(uint32_t var, VReg value);
+    void undo_to(size_t mark);
+
+    const Ast& m_ast;
+    const Interner& m_interner;
+    IrFunction* m_fn = nullptr;
+    BlockId m_block = 0;
+    bool m_streaming = false;
+    int m_depth = 0;
+    uint32_t m_slots = 0;           // top-level slots created so far
+    std::vector<uint8_t> m_need;    // label_register_need()
+    SymbolTable<Binding> m_names;
+    std::vector<VReg> m_env;        // current value of every variable
+    std::vector<std::pair<uint32_t, VReg>> m_log;   // (var, old value), inside ifs
+    int m_if_depth = 0;
+    std::vector<std::pair<uint32_t, VReg>> m_arm_values;
+    std::vector<uint32_t> m_seen;   // per var: stamp of the last arm/join that collected it
+    uint32_t m_stamp = 0;
+    std::vector<uint32_t> m_phi_vars;
+    std::vector<uint32_t> m_phi_row;    // per var: its row in m_phi_values
+    std::vector<VReg> m_phi_values;
+};
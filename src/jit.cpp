@@ -0,0 +1,37 @@
+#include "jit.hpp"
+#include "error.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+JitBuffer::~JitBuffer(){
+    if (m_data) munmap(m_data, m_capacity);
+}
+
+void JitBuffer::write(std::span<const uint8_t> code){
+    if (m_size + code.size() > m_capacity) {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t wanted = std::max(m_capacity * 2, m_size + code.size());
+        const size_t capacity = (wanted + page - 1) / page * page;
+        void* data = m_data ? mremap(m_data, m_capacity, capacity, MREMAP_MAYMOVE)
+                            : mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            throw CompileError(std::string("Error: cannot map code buffer: ") + std::strerror(errno));
+        }
+        m_data = static_cast<uint8_t*>(data);
+        m_capacity = capacity;
+    }
+    std::memcpy(m_data + m_size, code.data(), code.size());
+    m_size += code.size();
+}
+
+uint64_t JitBuffer::run(){
+    if (mprotect(m_data, m_capacity, PROT_READ | PROT_EXEC) != 0) {
+        throw CompileError(std::string("Error: cannot make code executable: ") + std::strerror(errno));
+    }
+    const auto entry = reinterpret_cast<uint64_t (*)()>(m_data);
+    return entry();
+}
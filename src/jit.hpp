@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Code to run inside this process. It is appended to an mmap'd read-write
+// buffer, which run() turns read + execute before calling into it. The code
+// is position independent, so the buffer can move while it grows.
+class JitBuffer{
+public:
+    JitBuffer() = default;
+    ~JitBuffer();
+
+    JitBuffer(const JitBuffer&) = delete;
+    JitBuffer& operator=(const JitBuffer&) = delete;
+
+    void write(std::span<const uint8_t> code);
+
+    size_t size() const {
+        return m_size;
+    }
+
+    // Calls the code at its first byte and returns what it leaves in rax.
+    // After this the buffer can no longer be written.
+    uint64_t run();
+private:
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+};
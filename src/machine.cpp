@@ -0,0 +1,93 @@
+#include "machine.hpp"
+#include "output.hpp"
+#include <string_view>
+
+static std::string_view op_name(MOp op){
+    switch (op){
+        case MOp::label: return "";
+        case MOp::mov: return "mov";
+        case MOp::movzx: return "movzx";
+        case MOp::add: return "add";
+        case MOp::sub: return "sub";
+        case MOp::imul: return "imul";
+        case MOp::mul: return "mul";
+        case MOp::lea: return "lea";
+        case MOp::shl: return "shl";
+        case MOp::shr: return "shr";
+        case MOp::neg: return "neg";
+        case MOp::xor_: return "xor";
+        case MOp::cmp: return "cmp";
+        case MOp::test: return "test";
+        case MOp::div: return "div";
+        case MOp::sete: return "sete";
+        case MOp::jmp: return "jmp";
+        case MOp::jz: return "jz";
+        case MOp::jnz: return "jnz";
+        case MOp::push: return "push";
+        case MOp::pop: return "pop";
+        case MOp::syscall: return "syscall";
+        case MOp::ret: return "ret";
+    }
+    return "?";
+}
+
+static std::string_view sized_reg_name(Reg reg, uint8_t size){
+    static constexpr std::string_view qwords[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    };
+    static constexpr std::string_view dwords[] = {
+        "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+        "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+    };
+    static constexpr std::string_view bytes[] = {
+        "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+        "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+    };
+    const uint8_t index = static_cast<uint8_t>(reg);
+    if (size == 4) return dwords[index];
+    if (size == 1) return bytes[index];
+    return qwords[index];
+}
+
+static void print_operand(const MOperand& op, OutputBuffer& out){
+    switch (op.kind){
+        case MOperand::Kind::reg:
+            out << sized_reg_name(op.reg, op.size);
+            break;
+        case MOperand::Kind::mem:
+            out << "QWORD [rsp + " << op.offset << "]";
+            break;
+        case MOperand::Kind::imm:
+            out << op.imm;
+            break;
+        case MOperand::Kind::label:
+            out << "label" << op.imm;
+            break;
+        case MOperand::Kind::addr:
+            out << '[' << sized_reg_name(op.reg, 8) << " + " << sized_reg_name(op.index, 8) << '*' << static_cast<int>(op.scale) << ']';
+            break;
+        case MOperand::Kind::none:
+            break;
+    }
+}
+
+void print_nasm(std::span<const MInst> code, OutputBuffer& out){
+    for (const MInst& inst : code){
+        if (inst.op == MOp::label) {
+            print_operand(inst.dst, out);
+            out << ":\n";
+            continue;
+        }
+        out << "    " << op_name(inst.op);
+        if (inst.dst.kind != MOperand::Kind::none) {
+            out << ' ';
+            print_operand(inst.dst, out);
+        }
+        if (inst.src.kind != MOperand::Kind::none) {
+            out << ", ";
+            print_operand(inst.src, out);
+        }
+        out << '\n';
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include "regalloc.hpp"
+
+class OutputBuffer;
+
+// x86-64 code as a list of instructions instead of text, so that it can be
+// rewritten (peephole.hpp) before it is printed. Only the forms the
+// generator produces are representable: memory operands are always a
+// qword at a constant offset above rsp.
+
+enum class MOp : uint8_t {
+    label,      // dst: label
+    mov,
+    movzx,
+    add,
+    sub,
+    imul,       // two-operand form
+    mul,        // rdx:rax = rax * dst
+    lea,        // src: address
+    shl,
+    shr,
+    neg,
+    xor_,
+    cmp,
+    test,
+    div,        // rdx:rax / dst
+    sete,
+    jmp,        // dst: label
+    jz,
+    jnz,
+    push,
+    pop,
+    syscall,
+    ret,        // with the result in rax
+};
+
+struct MOperand{
+    enum class Kind : uint8_t { none, reg, mem, imm, label, addr } kind = Kind::none;
+    uint8_t size = 8;       // reg: 8, 4 or 1 bytes
+    Reg reg = Reg::none;    // reg, or the base of an addr
+    Reg index = Reg::none;  // addr: reg + index * scale
+    uint8_t scale = 1;
+    uint32_t offset = 0;    // mem: bytes above rsp
+    uint64_t imm = 0;       // imm: the value; label: its number
+
+    bool operator==(const MOperand& other) const = default;
+
+    bool is_reg() const {
+        return kind == Kind::reg;
+    }
+    bool is_mem() const {
+        return kind == Kind::mem;
+    }
+    bool is_imm() const {
+        return kind == Kind::imm;
+    }
+    // an immediate that only mov can take
+    bool is_wide_imm() const {
+        return kind == Kind::imm && imm > INT32_MAX;
+    }
+};
+
+inline MOperand reg_op(Reg reg, uint8_t size = 8){
+    return {.kind = MOperand::Kind::reg, .size = size, .reg = reg};
+}
+
+inline MOperand mem_op(uint32_t offset){
+    return {.kind = MOperand::Kind::mem, .offset = offset};
+}
+
+inline MOperand imm_op(uint64_t value){
+    return {.kind = MOperand::Kind::imm, .imm = value};
+}
+
+// an address for lea
+inline MOperand addr_op(Reg base, Reg index, uint8_t scale){
+    return {.kind = MOperand::Kind::addr, .reg = base, .index = index, .scale = scale};
+}
+
+inline MOperand label_op(uint32_t label){
+    return {.kind = MOperand::Kind::label, .imm = label};
+}
+
+struct MInst{
+    MOp op;
+    MOperand dst;
+    MOperand src;
+};
+
+// NASM syntax, one instruction per line.
+void print_nasm(std::span<const MInst> code, OutputBuffer& out);
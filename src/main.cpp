@@ -1,51 +1,179 @@
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <optional>
 #include <vector>
 #include <string>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
-#include "parser.hpp"
-#include "tokenization.hpp"
-#include "generation.hpp"
+#include "cache.hpp"
+#include "driver.hpp"
+#include "server.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+static void usage(){
+    std::cerr << "incorrect usage\n";
+    std::cerr << "atom [--stream | --pipeline] [-O0 | -O] [--emit=asm | --emit=ir | --emit=bc] [--time-passes] [--stats] [--trace=<file.json>] [--no-peephole] [--peephole-stats] [--cache-stats] [-j <threads>] [-o <dir>] <input.at | -> [more inputs...]\n";
+    std::cerr << "atom --run [--stream | --pipeline] [-O0 | -O] [--time-passes] [--stats] [--trace=<file.json>] [--no-peephole] [--peephole-stats] <input.at | ->\n";
+    std::cerr << "atom --interp [--stream | --pipeline] [-O0 | -O] [--time-passes] [--stats] [--trace=<file.json>] <input.at | input.bc | ->\n";
+    std::cerr << "atom --serve [--socket <path>]\n";
+    std::cerr << "atom --client [--socket <path>] [--timing] [--stream | --pipeline] [-O0 | -O] <input.at | ->\n";
+}
+
+// One output per input, named after the input file. Inputs that share a
+// name get a numeric suffix so parallel compiles never write the same file;
+// the suffix skips names already taken, including those of inputs that are
+// called x-2 to begin with.
+static std::vector<std::string> output_names(const std::vector<std::string>& inputs, const std::string& dir){
+    std::vector<std::string> outputs;
+    std::unordered_set<std::string> taken;
+    std::unordered_map<std::string, int> suffix;   // by stem: the last one tried
+    for (const std::string& input : inputs) {
+        const std::string stem = input == "-" ? "stdin" : std::filesystem::path(input).stem().string();
+        std::string name = stem;
+        int& count = suffix.try_emplace(stem, 1).first->second;
+        while (!taken.insert(name).second) name = std::string(stem).append("-").append(std::to_string(++count));
+        outputs.push_back((std::filesystem::path(dir) / name).string());
+    }
+    return outputs;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "incorrect usage\n";
-        std::cerr << "atom <input.at>\n";
+    CompileOptions options;
+    std::vector<std::string> inputs;
+    std::optional<std::string> out_dir;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    bool server = false;
+    bool client = false;
+    bool run = false;
+    bool interp = false;
+    bool show_timing = false;
+    bool cache_stats = false;
+    std::optional<std::string> trace_path;
+    std::string socket_path = default_socket_path();
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--stream") == 0) options.streaming = true;
+        else if (std::strcmp(argv[i], "--pipeline") == 0) options.streaming = options.pipelined = true;
+        else if (std::strcmp(argv[i], "-O") == 0 || std::strcmp(argv[i], "-O1") == 0) options.opt_level = 1;
+        else if (std::strcmp(argv[i], "-O0") == 0) options.opt_level = 0;
+        else if (std::strcmp(argv[i], "--emit=asm") == 0) options.emit = Emit::assembly;
+        else if (std::strcmp(argv[i], "--emit=ir") == 0) options.emit = Emit::ir;
+        else if (std::strcmp(argv[i], "--emit=bc") == 0) options.emit = Emit::bytecode;
+        else if (std::strcmp(argv[i], "--time-passes") == 0) options.time_passes = true;
+        else if (std::strcmp(argv[i], "--stats") == 0) options.stats = true;
+        else if (std::strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8]) trace_path = argv[i] + 8;
+        else if (std::strcmp(argv[i], "--no-peephole") == 0) options.peephole = false;
+        else if (std::strcmp(argv[i], "--peephole-stats") == 0) options.peephole_stats = true;
+        else if (std::strcmp(argv[i], "--cache-stats") == 0) cache_stats = true;
+        else if (std::strcmp(argv[i], "--run") == 0) run = true;
+        else if (std::strcmp(argv[i], "--interp") == 0) interp = true;
+        else if (std::strcmp(argv[i], "--serve") == 0) server = true;
+        else if (std::strcmp(argv[i], "--client") == 0) client = true;
+        else if (std::strcmp(argv[i], "--timing") == 0) show_timing = true;
+        else if (std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc) socket_path = argv[++i];
+        else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_dir = argv[++i];
+        else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = std::max(1, std::atoi(argv[++i]));
+        else inputs.push_back(argv[i]);
+    }
+    if (server && inputs.empty()) {
+        return serve(socket_path);
+    }
+    if (server || inputs.empty() || (client && (inputs.size() != 1 || out_dir || options.stats || trace_path))
+        || ((run || interp) && (run == interp || client || inputs.size() != 1 || out_dir || options.emit != Emit::binary))) {
+        usage();
         return EXIT_FAILURE;
     }
-
-    std::string contents;
-    {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
+    if (client) {
+        try {
+            return client_compile(socket_path, inputs[0], "out", options, show_timing);
+        } catch (const std::exception& err) {
+            std::cerr << err.what() << '\n';
+            return EXIT_FAILURE;
+        }
     }
 
-    if (contents.empty()) {
-        std::cerr << "Error: Input file is empty\n";
-        return EXIT_FAILURE;
+    // spans of every compile below, written out once they are all done
+    std::optional<Trace> trace;
+    if (trace_path) trace.emplace();
+    const auto write_trace = [&] {
+        if (!trace) return true;
+        try {
+            trace->write(trace_path.value());
+            return true;
+        } catch (const std::exception& err) {
+            std::cerr << err.what() << '\n';
+            return false;
+        }
+    };
+
+    // the program's exit code becomes ours, as if out had been run
+    if (run || interp) {
+        CompileContext ctx;
+        ctx.trace = trace ? &trace.value() : nullptr;
+        try {
+            const uint64_t result = run ? run_file(inputs[0], options, ctx) : interpret_file(inputs[0], options, ctx);
+            return write_trace() ? static_cast<int>(result & 0xff) : EXIT_FAILURE;
+        } catch (const std::exception& err) {
+            std::cerr << err.what() << '\n';
+            write_trace();
+            return EXIT_FAILURE;
+        }
     }
 
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
+    const std::unique_ptr<CompileCache> cache = CompileCache::from_env();
+    const auto report_cache = [&] {
+        if (cache_stats && cache) cache->report(std::cerr);
+    };
+
+    // a single input without -o keeps the classic out.asm / out.o / out
+    if (inputs.size() == 1 && !out_dir) {
+        CompileContext ctx;
+        ctx.cache = cache.get();
+        ctx.trace = trace ? &trace.value() : nullptr;
+        try {
+            compile_file(inputs[0], "out", options, ctx);
+        } catch (const std::exception& err) {
+            std::cerr << err.what() << '\n';
+            write_trace();
+            return EXIT_FAILURE;
+        }
+        report_cache();
+        return write_trace() ? 0 : EXIT_FAILURE;
+    }
 
-    Parser parser(std::move(tokens));
-    std::optional<nodeProg> prog = parser.parse_prog();
-    if (!prog.has_value()){
-        std::cerr << "invalid program\n";
-        exit(EXIT_FAILURE);
+    const std::string dir = out_dir.value_or(".");
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        std::cerr << "Error: cannot create " << dir << ": " << ec.message() << '\n';
+        return EXIT_FAILURE;
     }
+    const std::vector<std::string> outputs = output_names(inputs, dir);
 
-    Generator generator(prog.value());
-    {
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.gen_prog();
+    ThreadPool pool(std::min(threads, inputs.size()));
+    std::vector<CompileContext> contexts(pool.size());
+    for (CompileContext& ctx : contexts) {
+        ctx.cache = cache.get();
+        ctx.trace = trace ? &trace.value() : nullptr;
     }
+    std::vector<std::string> errors(inputs.size());
+    pool.run(inputs.size(), [&](size_t task, size_t worker) {
+        try {
+            compile_file(inputs[task], outputs[task], options, contexts[worker]);
+        } catch (const std::exception& err) {
+            errors[task] = err.what();
+        }
+    });
 
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
-    return 0;
-}
\ No newline at end of file
+    int failed = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (errors[i].empty()) continue;
+        std::cerr << inputs[i] << ": " << errors[i] << '\n';
+        failed++;
+    }
+    report_cache();
+    return write_trace() && !failed ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,93 @@
+#include "output.hpp"
+#include "error.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static void write_failed(){
+    throw CompileError(std::string("Error: write failed: ") + std::strerror(errno));
+}
+
+OutputBuffer::OutputBuffer(const std::string& path, bool executable){
+    m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, executable ? 0777 : 0666);
+    if (m_fd < 0) {
+        throw CompileError("Error: cannot open " + path + ": " + std::strerror(errno));
+    }
+    m_chunks.push_back(std::make_unique_for_overwrite<char[]>(k_chunk_size));
+    m_pos = m_chunks[0].get();
+    m_end = m_pos + k_chunk_size;
+}
+
+OutputBuffer::~OutputBuffer(){
+    close(m_fd);
+}
+
+void OutputBuffer::write(std::string_view text){
+    while (!text.empty()) {
+        if (m_pos == m_end) next_chunk();
+        const size_t count = std::min(text.size(), static_cast<size_t>(m_end - m_pos));
+        std::memcpy(m_pos, text.data(), count);
+        m_pos += count;
+        text.remove_prefix(count);
+    }
+}
+
+void OutputBuffer::next_chunk(){
+    m_lengths.push_back(static_cast<size_t>(m_pos - m_chunks[m_lengths.size()].get()));
+    if (m_lengths.size() == k_chunks_per_write) write_out();
+    const size_t index = m_lengths.size();
+    if (index == m_chunks.size()) m_chunks.push_back(std::make_unique_for_overwrite<char[]>(k_chunk_size));
+    m_pos = m_chunks[index].get();
+    m_end = m_pos + k_chunk_size;
+}
+
+void OutputBuffer::write_out(){
+    iovec iov[k_chunks_per_write];
+    size_t count = 0;
+    for (size_t i = 0; i < m_lengths.size(); ++i){
+        if (m_lengths[i]) iov[count++] = {.iov_base = m_chunks[i].get(), .iov_len = m_lengths[i]};
+    }
+    m_lengths.clear();
+    // a write can stop short; carry on from where it did
+    iovec* next = iov;
+    while (count) {
+        const ssize_t written = ::writev(m_fd, next, static_cast<int>(count));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            write_failed();
+        }
+        size_t left = static_cast<size_t>(written);
+        while (count && left >= next->iov_len) {
+            left -= next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count) {
+            next->iov_base = static_cast<char*>(next->iov_base) + left;
+            next->iov_len -= left;
+        }
+    }
+}
+
+void OutputBuffer::flush(){
+    m_lengths.push_back(static_cast<size_t>(m_pos - m_chunks[m_lengths.size()].get()));
+    write_out();
+    m_pos = m_chunks[0].get();
+    m_end = m_pos + k_chunk_size;
+}
+
+void OutputBuffer::patch(uint64_t offset, std::span<const uint8_t> bytes){
+    flush();
+    while (!bytes.empty()) {
+        const ssize_t written = ::pwrite(m_fd, bytes.data(), bytes.size(), static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            write_failed();
+        }
+        bytes = bytes.subspan(static_cast<size_t>(written));
+        offset += static_cast<uint64_t>(written);
+    }
+}
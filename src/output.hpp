@@ -0,0 +1,70 @@
+#pragma once
+
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Buffered output to a file. Text is formatted straight into fixed-size
+// chunks (integers with std::to_chars, no temporary strings), and the
+// filled chunks go to the kernel together in one writev once enough of
+// them have piled up. Nothing reaches the file before flush() but what
+// those writes have already handed over.
+class OutputBuffer{
+public:
+    // Creates or truncates path; an executable gets the exec bits the
+    // umask allows.
+    OutputBuffer(const std::string& path, bool executable);
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void write(std::string_view text);
+    void write(std::span<const uint8_t> bytes){
+        write(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+    }
+
+    OutputBuffer& operator<<(std::string_view text){
+        write(text);
+        return *this;
+    }
+
+    OutputBuffer& operator<<(char c){
+        if (m_pos == m_end) next_chunk();
+        *m_pos++ = c;
+        return *this;
+    }
+
+    template <std::integral T>
+    OutputBuffer& operator<<(T value){
+        if (m_end - m_pos < k_max_digits) next_chunk();
+        m_pos = std::to_chars(m_pos, m_end, value).ptr;
+        return *this;
+    }
+
+    // Overwrites bytes that were written before, at offset from the start
+    // of the file. Everything pending is flushed first.
+    void patch(uint64_t offset, std::span<const uint8_t> bytes);
+
+    void flush();
+private:
+    static constexpr size_t k_chunk_size = 64 * 1024;
+    static constexpr size_t k_chunks_per_write = 16;
+    static constexpr std::ptrdiff_t k_max_digits = 20;
+
+    // closes the current chunk and starts writing into the next one
+    void next_chunk();
+    // hands the closed chunks to the kernel
+    void write_out();
+
+    int m_fd = -1;
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    std::vector<size_t> m_lengths;  // of the closed chunks
+    char* m_pos = nullptr;
+    char* m_end = nullptr;
+};
@@ -1,307 +1,266 @@
 #include "parser.hpp"
+#include "error.hpp"
 
-Parser::Parser(std::vector<Token> tokens) : m_tokens(std::move(tokens)), m_allocator(1024*1024*4){}
+Parser::Parser(std::vector<Token> tokens, Ast& ast) : m_tokens(std::move(tokens)), m_ast(ast){}
 
-void Parser::error_expected(const std::string& msg) const{
-  std::cerr << "[Parse Error] Expected " << msg << " on line " << peek(-1).value().line << std::endl;
-  exit(EXIT_FAILURE);
+Parser::Parser(TokenSource& source, Ast& ast) : m_source(&source), m_ast(ast){}
+
+// makes sure count tokens starting at m_index are buffered
+bool Parser::fill(size_t count){
+    if (!m_source) return false;
+    // drop consumed tokens, but keep the last one for error reporting
+    if (m_index > 1) {
+        m_tokens.erase(m_tokens.begin(), m_tokens.begin() + static_cast<std::ptrdiff_t>(m_index - 1));
+        m_index = 1;
+    }
+    while (m_tokens.size() < m_index + count) {
+        const size_t old_size = m_tokens.size();
+        m_tokens.resize(old_size + Tokenizer::k_batch_size);
+        const size_t n = m_source->read(m_tokens.data() + old_size, Tokenizer::k_batch_size);
+        m_tokens.resize(old_size + n);
+        if (n == 0) {
+            m_source = nullptr;
+            return false;
+        }
+    }
+    return true;
+}
+
+void Parser::error_expected(const std::string& msg){
+  const Token* prev = peek(-1);
+  throw CompileError("[Parse Error] Expected " + msg + " on line " + std::to_string(prev ? prev->line : 1));
+}
+
+StmtRange Parser::commit_list(size_t base){
+    const StmtRange range{.first = static_cast<uint32_t>(m_ast.stmt_lists.size()), .count = static_cast<uint32_t>(m_pending.size() - base)};
+    m_ast.stmt_lists.insert(m_ast.stmt_lists.end(), m_pending.begin() + static_cast<std::ptrdiff_t>(base), m_pending.end());
+    m_pending.resize(base);
+    return range;
 }
 
-std::optional<nodeTerm*> Parser::parse_term(){
-    if (!peek().has_value()) {
-        std::cerr << "parse_term: no token to parse" << std::endl;
+std::optional<NodeId> Parser::parse_term(){
+    if (!peek()) {
         return {};
     }
 
-    if (peek().has_value() && peek().value().type == TokenType::int_lit){
-        auto term_int_lit = m_allocator.alloc<nodeTermIntLit>();
-        term_int_lit->int_lit = consume();
-        auto term = m_allocator.alloc<nodeTerm>();
-        term->var = term_int_lit;
-        return term;
+    if (peek()->type == TokenType::int_lit){
+        m_ast.ints.push_back(consume().value);
+        return add_expr({.kind = ExprKind::int_lit, .lit = static_cast<uint32_t>(m_ast.ints.size() - 1), .rhs = k_no_node});
     }
-    else if (peek().has_value() && peek().value().type == TokenType::ident){
-        auto term_ident = m_allocator.alloc<nodeTermIdent>();
-        term_ident->ident = consume();
-        auto term = m_allocator.alloc<nodeTerm>();
-        term->var = term_ident;
-        return term;
+    else if (peek()->type == TokenType::ident){
+        return add_expr({.kind = ExprKind::ident, .ident = static_cast<SymbolId>(consume().value), .rhs = k_no_node});
     }
-    else if (peek().has_value() && peek().value().type == TokenType::open_paren){
+    else if (peek()->type == TokenType::open_paren){
         consume();
 
         const auto expr = parse_expr(0);
         if (!expr.has_value()){
             error_expected("expression");
         }
-        if (!(peek().has_value() && peek().value().type == TokenType::close_paren)) {
+        if (!(peek() && peek()->type == TokenType::close_paren)) {
             error_expected("')'");
         }
         consume();
-
-        auto term_paren = m_allocator.alloc<nodeTermParen>();
-        term_paren->expr = expr.value();
-        auto term = m_allocator.alloc<nodeTerm>();
-        term->var = term_paren;
-        return term;
-
+        // parentheses only group, they do not need a node of their own
+        return expr;
     }
     else return {};
 }
 
-std::optional<nodeExpr*> Parser::parse_expr(int min_prec = 0){
+static ExprKind bin_expr_kind(TokenType op){
+    switch (op){
+        case TokenType::plus: return ExprKind::add;
+        case TokenType::star: return ExprKind::multi;
+        case TokenType::minus: return ExprKind::sub;
+        case TokenType::fslash: return ExprKind::div;
+        default: return ExprKind::eq;
+    }
+}
 
-    std::optional<nodeTerm*> term_lhs = parse_term();
-    if (!term_lhs.has_value()) return {};
+std::optional<NodeId> Parser::parse_expr(int min_prec = 0){
 
-    auto expr_lhs = m_allocator.alloc<nodeExpr>();
-    expr_lhs->var = term_lhs.value();
+    std::optional<NodeId> expr_lhs = parse_term();
+    if (!expr_lhs.has_value()) return {};
 
     while (true){
-        std::optional<Token> curr_token = peek();
+        const Token* curr_token = peek();
 
-        if (!curr_token.has_value() || curr_token->type == TokenType::close_paren || curr_token->type == TokenType::close_curly || curr_token->type == TokenType::semi) {
+        if (!curr_token || curr_token->type == TokenType::close_paren || curr_token->type == TokenType::close_curly || curr_token->type == TokenType::semi) {
             break;
         }
 
         std::optional<int> prec = bin_prec(curr_token->type);
         if (prec < min_prec) break;
 
-        Token op = consume();
+        const TokenType op = consume().type;
         int next_min_prec = prec.value() + 1;
         auto expr_rhs = parse_expr(next_min_prec);
         if (!expr_rhs.has_value()){
-            std::cerr << "unable to parse an expression\n";
-            exit(EXIT_FAILURE);
+            throw CompileError("unable to parse an expression");
         }
 
-        auto expr = m_allocator.alloc<nodeBinExpr>();
-        auto expr_lhs2 = m_allocator.alloc<nodeExpr>();
-
-        if (op.type == TokenType::plus){
-            auto add = m_allocator.alloc<nodeBinExprAdd>();
-            expr_lhs2->var = expr_lhs->var;
-            add->lhs = expr_lhs2;
-            add->rhs = expr_rhs.value();
-            expr->var = add;
-        } else if (op.type == TokenType::star){
-            auto multi = m_allocator.alloc<nodeBinExprMulti>();
-            expr_lhs2->var = expr_lhs->var;
-            multi->lhs = expr_lhs2;
-            multi->rhs = expr_rhs.value();
-            expr->var = multi;
-        } else if (op.type == TokenType::minus){
-            auto sub = m_allocator.alloc<nodeBinExprSub>();
-            expr_lhs2->var = expr_lhs->var;
-            sub->lhs = expr_lhs2;
-            sub->rhs = expr_rhs.value();
-            expr->var = sub;
-        } else if (op.type == TokenType::fslash){
-            auto div = m_allocator.alloc<nodeBinExprDiv>();
-            expr_lhs2->var = expr_lhs->var;
-            div->lhs = expr_lhs2;
-            div->rhs = expr_rhs.value();
-            expr->var = div;
-        } else if (op.type == TokenType::eqeq){
-            auto eq_expr = m_allocator.alloc<nodeBinExprEq>();
-            expr_lhs2->var = expr_lhs->var;
-            eq_expr->lhs = expr_lhs2;
-            eq_expr->rhs = expr_rhs.value();
-            expr->var = eq_expr;
-        }
-
-        expr_lhs->var = expr;
+        expr_lhs = add_expr({.kind = bin_expr_kind(op), .lhs = expr_lhs.value(), .rhs = expr_rhs.value()});
     }
     return expr_lhs;
 }
 
-std::optional<nodeScope*> Parser::parse_scope(){
-    auto scope = m_allocator.alloc<nodeScope>();
+std::optional<StmtRange> Parser::parse_scope(){
+    const size_t base = m_pending.size();
     while (auto stmt = parse_stmt()){
-        scope->stmts.push_back(stmt.value());
+        m_pending.push_back(stmt.value());
     }
-    if (peek().has_value() && peek().value().type == TokenType::close_curly){
+    if (peek() && peek()->type == TokenType::close_curly){
         consume();
     } else {
-        std::cerr << "expected '}'\n";
-        exit(EXIT_FAILURE);
+        throw CompileError("expected '}'");
     }
-    return scope;
+    return commit_list(base);
 }
 
-std::optional<nodeIfPred*> Parser::parse_if_pred(){
+std::optional<NodeId> Parser::parse_if_pred(){
     if (try_consume(TokenType::elif)){
-        try_consume(TokenType::open_paren);
-        const auto elif = m_allocator.alloc<nodeIfPredElif>();
+        try_consume_err(TokenType::open_paren);
+        nodeIfPred elif{.kind = PredKind::elif, .expr = k_no_node, .scope = {}, .next = k_no_node};
         if (const auto expr = parse_expr()){
-            elif->expr = expr.value();
+            elif.expr = expr.value();
         } else{
-            std::cerr << "expected expression\n";
-            exit(EXIT_FAILURE);
+            throw CompileError("expected expression");
         }
-        try_consume(TokenType::close_paren);
+        try_consume_err(TokenType::close_paren);
+        try_consume_err(TokenType::open_curly);
         if (const auto scope = parse_scope()){
-            elif->scope = scope.value();
+            elif.scope = scope.value();
         } else {
-            std::cerr << "expected scope\n";
-            exit(EXIT_FAILURE);
+            throw CompileError("expected scope");
         }
-        elif->pred = parse_if_pred();
-        auto pred = m_allocator.alloc<nodeIfPred>();
-        pred->var = elif;
-        return pred;
+        elif.next = parse_if_pred().value_or(k_no_node);
+        return add_pred(elif);
     }
     if (try_consume(TokenType::else_)){
-        const auto else_pred = m_allocator.alloc<nodeIfPredElse>();
+        try_consume_err(TokenType::open_curly);
+        nodeIfPred else_pred{.kind = PredKind::else_, .expr = k_no_node, .scope = {}, .next = k_no_node};
         if (const auto scope = parse_scope()){
-            else_pred->scope = scope.value();
+            else_pred.scope = scope.value();
         } else {
-            std::cerr << "expected scope\n";
-            exit(EXIT_FAILURE);
+            throw CompileError("expected scope");
         }
-        auto pred = m_allocator.alloc<nodeIfPred>();
-        pred->var = else_pred;
-        return pred;
+        return add_pred(else_pred);
     }
     return {};
 }
 
-std::optional<nodeStmt*> Parser::parse_stmt(){
-    while(peek().has_value()){
+std::optional<NodeId> Parser::parse_stmt(){
+    while(peek()){
 
         // ======= возвращаем значение =========
 
-        if (peek().value().type == TokenType::_exit && peek(1).has_value() && peek(1).value().type == TokenType::open_paren){
+        if (peek()->type == TokenType::_exit && peek(1) && peek(1)->type == TokenType::open_paren){
             consume();
             consume();
-            auto stmt_exit = m_allocator.alloc<nodeStmtExit>();
+            nodeStmt stmt_exit{.kind = StmtKind::exit, .ident = 0, .expr = k_no_node, .scope = {}};
             if (auto node_expr = parse_expr()){
-                stmt_exit->expr = node_expr.value();
+                stmt_exit.expr = node_expr.value();
             } else {
-                std::cerr << "invalid expression\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("invalid expression");
             }
-            if (peek().has_value() && peek().value().type == TokenType::close_paren){
+            if (peek() && peek()->type == TokenType::close_paren){
                 consume();
             } else {
-                std::cerr << "expected ')'\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("expected ')'");
             }
-            if (peek().has_value() && peek().value().type == TokenType::semi){
+            if (peek() && peek()->type == TokenType::semi){
                 consume();
             } else{
-                std::cerr << "expected ';'\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("expected ';'");
             }
-            auto stmt = m_allocator.alloc<nodeStmt>();
-            stmt->var = stmt_exit;
-            return stmt;
+            return add_stmt(stmt_exit);
         }
 
         // ======= объявление переменных =======
 
-        else if (peek().has_value() && peek().value().type == TokenType::let
-                && peek(1).has_value() && peek(1).value().type == TokenType::ident
-                && peek(2).has_value() && peek(2).value().type == TokenType::eq){
+        else if (peek()->type == TokenType::let
+                && peek(1) && peek(1)->type == TokenType::ident
+                && peek(2) && peek(2)->type == TokenType::eq){
             consume();
 
-            auto stmt_let = m_allocator.alloc<nodeStmtLet>();
-            stmt_let->ident = consume();
+            nodeStmt stmt_let{.kind = StmtKind::let, .ident = static_cast<SymbolId>(consume().value), .expr = k_no_node, .scope = {}};
 
             consume();
 
             if (auto n_expr = parse_expr()){
-                stmt_let->expr = n_expr.value();
+                stmt_let.expr = n_expr.value();
             } else {
-                std::cerr << "invalid expression\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("invalid expression");
             }
-            if (peek().has_value() && peek().value().type == TokenType::semi) {
+            if (peek() && peek()->type == TokenType::semi) {
                 consume();
             } else {
-                std::cerr << "expected ';'\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("expected ';'");
             }
-            auto stmt = m_allocator.alloc<nodeStmt>();
-            stmt->var = stmt_let;
-            return stmt;
+            return add_stmt(stmt_let);
         }
 
         // ======= переприсваивание =======
 
-        if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value() && peek(1).value().type == TokenType::eq){
-            const auto assign = m_allocator.alloc<nodeStmtAssign>();
-            assign->ident = consume();
+        if (peek()->type == TokenType::ident && peek(1) && peek(1)->type == TokenType::eq){
+            nodeStmt assign{.kind = StmtKind::assign, .ident = static_cast<SymbolId>(consume().value), .expr = k_no_node, .scope = {}};
             consume();
             if (const auto expr = parse_expr()){
-                assign->expr = expr.value();
+                assign.expr = expr.value();
             } else {
-                std::cerr << "expected expression\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("expected expression");
             }
             try_consume(TokenType::semi);
-            auto stmt = m_allocator.alloc<nodeStmt>();
-            stmt->var = assign;
-            return stmt;
+            return add_stmt(assign);
         }
 
         // ======= { блок } =======
 
-        else if (peek().has_value() && peek().value().type == TokenType::open_curly){
+        else if (peek()->type == TokenType::open_curly){
             consume();
             if (auto scope = parse_scope()) {
-                auto stmt = m_allocator.alloc<nodeStmt>();
-                stmt->var = scope.value();
-                return stmt;
+                return add_stmt({.kind = StmtKind::scope, .ident = 0, .expr = k_no_node, .scope = scope.value()});
             } else{
-                std::cerr << "invalid scope'\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("invalid scope'");
             }
         }
 
         // ======= условие =======
 
-        else if (peek().has_value() && peek().value().type == TokenType::if_){
+        else if (peek()->type == TokenType::if_){
             consume();
 
-            if (peek().has_value() && peek().value().type == TokenType::open_paren){
+            if (peek() && peek()->type == TokenType::open_paren){
                 consume();
             } else {
-                std::cerr << "expected '('\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("expected '('");
             }
 
-            auto stmt_if = m_allocator.alloc<nodeStmtIf>();
+            nodeStmt stmt_if{.kind = StmtKind::if_, .pred = k_no_node, .expr = k_no_node, .scope = {}};
 
             if (auto expr = parse_expr()){
-                stmt_if->expr = expr.value();
+                stmt_if.expr = expr.value();
             } else {
-                std::cerr << "expected condition\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("expected condition");
             }
 
-            if (!peek().has_value() || peek().value().type != TokenType::close_paren){
-                std::cerr << "expected ')', got " << (peek().has_value() ? to_string(peek()->type) : "EOF") << std::endl;
-                exit(EXIT_FAILURE);
+            if (!peek() || peek()->type != TokenType::close_paren){
+                throw CompileError("expected ')', got " + (peek() ? to_string(peek()->type) : "EOF"));
             }
             consume();
 
-            if (peek().has_value() && peek().value().type == TokenType::open_curly) {
+            if (peek() && peek()->type == TokenType::open_curly) {
                 consume();
             } else {
-                std::cerr << "expected '{' after if condition\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("expected '{' after if condition");
             }
             if (auto scope = parse_scope()){
-                stmt_if->scope = scope.value();
+                stmt_if.scope = scope.value();
             } else {
-                std::cerr << "invalid scope\n";
-                exit(EXIT_FAILURE);
+                throw CompileError("invalid scope");
             }
-            stmt_if->pred = parse_if_pred();
-            auto stmt = m_allocator.alloc<nodeStmt>();
-            stmt->var = stmt_if;
-            return stmt;
+            stmt_if.pred = parse_if_pred().value_or(k_no_node);
+            return add_stmt(stmt_if);
         }
         else return {};
     }
@@ -310,14 +269,13 @@ std::optional<nodeStmt*> Parser::parse_stmt(){
 }
 
 std::optional<nodeProg> Parser::parse_prog(){
-    nodeProg prog;
-    while(peek().has_value()){
+    const size_t base = m_pending.size();
+    while(peek()){
         if (auto stmt = parse_stmt()){
-            prog.stmts.push_back(stmt.value());
+            m_pending.push_back(stmt.value());
         } else {
-            std::cerr << "invalid statement\n";
-            exit(EXIT_FAILURE);
+            throw CompileError("invalid statement");
         }
     }
-    return prog;
-}
\ No newline at end of file
+    return nodeProg{.stmts = commit_list(base)};
+}
@@ -1,147 +1,98 @@
 #pragma once
 
-#include <variant>
 #include <iostream>
-#include "arena.hpp"
+#include "ast.hpp"
 #include "tokenization.hpp"
 #include <string>
 
-struct nodeExpr;
-struct nodeTermParen;
-
-struct nodeBinExprAdd{
-    nodeExpr* lhs;
-    nodeExpr* rhs;
-};
-
-struct nodeBinExprMulti{
-    nodeExpr* lhs;
-    nodeExpr* rhs;
-};
-
-struct nodeBinExprSub{
-    nodeExpr* lhs;
-    nodeExpr* rhs;
-};
-
-struct nodeBinExprDiv{
-    nodeExpr* lhs;
-    nodeExpr* rhs;
-};
-
-struct nodeBinExprEq{
-    nodeExpr* lhs;
-    nodeExpr* rhs;
-};
-
-struct nodeBinExpr{
-    std::variant<nodeBinExprEq*, nodeBinExprAdd*, nodeBinExprMulti*, nodeBinExprDiv*, nodeBinExprSub*> var;
-};
-
-struct nodeTermIntLit{
-    Token int_lit;
-};
-
-struct nodeTermIdent{
-    Token ident;
-};
-
-struct nodeTerm{
-    std::variant<nodeTermIntLit*, nodeTermIdent*, nodeTermParen*> var;
-};
-
-struct nodeExpr{
-    std::variant<nodeTerm*, nodeBinExpr*> var;
-};
-
-struct nodeTermParen{
-    nodeExpr* expr;
-};
-
-struct nodeStmtExit{
-    nodeExpr* expr;
-};
-struct nodeStmtLet{
-    Token ident;
-    nodeExpr* expr{};
-};
-
-struct nodeStmt;
-struct nodeIfPred;
-struct nodeScope{
-    std::vector<nodeStmt*> stmts;
-};
-struct nodeStmtIf{
-    nodeExpr* expr;
-    nodeScope* scope;
-    std::optional<nodeIfPred*> pred;
-};
-struct nodeIfPredElif{
-    nodeExpr* expr;
-    nodeScope* scope;
-    std::optional<nodeIfPred*> pred;
-};
-struct nodeIfPredElse{
-    nodeScope* scope;
-};
-struct nodeIfPred{
-    std::variant<nodeIfPredElif*, nodeIfPredElse*> var;
-};
-struct nodeStmtAssign{
-    Token ident;
-    nodeExpr* expr {};
-};
-
-struct nodeStmt{
-    std::variant<nodeStmtExit*, nodeStmtLet*, nodeScope*, nodeStmtIf*, nodeStmtAssign*> var;
-};
-struct nodeProg{
-    std::vector<nodeStmt*> stmts;
-};
-
 class Parser{
 public:
-    explicit Parser(std::vector<Token> tokens);
+    Parser(std::vector<Token> tokens, Ast& ast);
+
+    // Streaming mode: tokens are pulled from the source as they are needed,
+    // Tokenizer::k_batch_size at a time.
+    Parser(TokenSource& source, Ast& ast);
 
-    void error_expected(const std::string& msg) const;
+    void error_expected(const std::string& msg);
 
-    std::optional<nodeTerm*> parse_term();
+    std::optional<NodeId> parse_term();
 
-    std::optional<nodeExpr*> parse_expr(int min_prec);
+    std::optional<NodeId> parse_expr(int min_prec);
 
-    std::optional<nodeScope*> parse_scope();
+    std::optional<StmtRange> parse_scope();
 
-    std::optional<nodeIfPred*> parse_if_pred();
+    std::optional<NodeId> parse_if_pred();
 
-    std::optional<nodeStmt*> parse_stmt();
+    std::optional<NodeId> parse_stmt();
 
     std::optional<nodeProg> parse_prog();
 
+    // Hands the token buffer back to the caller once parsing is done.
+    std::vector<Token> release_tokens() {
+        m_index = 0;
+        return std::move(m_tokens);
+    }
+
+    bool at_end() {
+        return !peek();
+    }
+
+    // Drops every node parsed so far. Only valid once the caller is done
+    // with them, e.g. after a streamed statement has been generated.
+    void release_nodes() {
+        m_ast.clear();
+    }
+
 private:
-    const std::vector<Token> m_tokens;
+    std::vector<Token> m_tokens;
     size_t m_index = 0;
-    std::optional<Token> peek(int offset = 0) const {
-        if (m_index + offset >= m_tokens.size()) return {};
-        return m_tokens[m_index + offset];
+    TokenSource* m_source = nullptr;
+
+    bool fill(size_t count);
+
+    const Token* peek(int offset = 0) {
+        if (m_index + offset >= m_tokens.size() && !(offset >= 0 && fill(offset + 1))) return nullptr;
+        return &m_tokens[m_index + offset];
     }
-    inline Token consume(){
+    inline const Token& consume(){
         return m_tokens.at(m_index++);
     }
-    Token try_consume_err(const TokenType type)
+    const Token* try_consume_err(const TokenType type)
     {
-        if (peek().has_value() && peek().value().type == type) {
-            return consume();
+        if (peek() && peek()->type == type) {
+            return &consume();
         }
         error_expected(to_string(type));
-        return {};
+        return nullptr;
     }
 
-    std::optional<Token> try_consume(const TokenType type)
+    const Token* try_consume(const TokenType type)
     {
-        if (peek().has_value() && peek().value().type == type) {
-            return consume();
+        if (peek() && peek()->type == type) {
+            return &consume();
         }
-        return {};
+        return nullptr;
+    }
+    NodeId add_expr(const nodeExpr& expr) {
+        m_ast.exprs.push_back(expr);
+        return static_cast<NodeId>(m_ast.exprs.size() - 1);
+    }
+
+    NodeId add_stmt(const nodeStmt& stmt) {
+        m_ast.stmts.push_back(stmt);
+        return static_cast<NodeId>(m_ast.stmts.size() - 1);
     }
-    ArenaAllocator m_allocator;
+
+    NodeId add_pred(const nodeIfPred& pred) {
+        m_ast.preds.push_back(pred);
+        return static_cast<NodeId>(m_ast.preds.size() - 1);
+    }
+
+    // Moves the statement ids collected in m_pending since base into
+    // Ast::stmt_lists. Children of nested scopes are collected above base
+    // and committed first, so every list ends up contiguous.
+    StmtRange commit_list(size_t base);
+
+    Ast& m_ast;
+    std::vector<NodeId> m_pending;
 };
\ No newline at end of file
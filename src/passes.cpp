@@ -0,0 +1,261 @@
+#include "passes.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+#include <time.h>
+#include <unordered_set>
+
+void PassManager::add(const char* name, Pass pass){
+    m_passes.push_back({name, pass});
+}
+
+void PassManager::run(IrFunction& fn){
+    for (const Entry& entry : m_passes){
+        time(entry.name, [&]{ entry.pass(fn); });
+    }
+}
+
+PassManager::Timing& PassManager::timing(const char* name){
+    auto it = std::find_if(m_timings.begin(), m_timings.end(), [&](const Timing& t){ return std::strcmp(t.name, name) == 0; });
+    if (it != m_timings.end()) return *it;
+    return m_timings.emplace_back(Timing{name, std::chrono::nanoseconds{0}, 0});
+}
+
+void PassManager::record(const char* name, std::chrono::nanoseconds elapsed){
+    Timing& t = timing(name);
+    t.total += elapsed;
+    t.runs++;
+    if (m_cpu) {
+        t.window += elapsed;
+        m_window += elapsed;
+        if (m_window >= k_cpu_window) settle_cpu();
+    }
+}
+
+void PassManager::record_external(const char* name, std::chrono::nanoseconds elapsed){
+    Timing& t = timing(name);
+    t.total += elapsed;
+    t.runs++;
+    // what starting and waiting for the tool cost is not a stage's
+    settle_cpu();
+}
+
+void PassManager::record_cpu(const char* name, std::chrono::nanoseconds cpu){
+    timing(name).cpu += cpu;
+}
+
+void PassManager::merge(const PassManager& other){
+    for (const Timing& theirs : other.m_timings){
+        Timing& t = timing(theirs.name);
+        t.total += theirs.total;
+        t.runs += theirs.runs;
+        t.cpu += theirs.cpu;
+    }
+    m_cpu |= other.m_cpu;
+}
+
+static std::chrono::nanoseconds thread_cpu_time(){
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+void PassManager::instrument(bool cpu, Trace* trace){
+    m_cpu = cpu;
+    m_trace = trace;
+    if (cpu) m_cpu_mark = thread_cpu_time();
+}
+
+void PassManager::settle_cpu(){
+    if (!m_cpu) return;
+    const std::chrono::nanoseconds now = thread_cpu_time();
+    const double used = static_cast<double>((now - m_cpu_mark).count());
+    m_cpu_mark = now;
+    if (m_window.count() == 0) return;
+    for (Timing& t : m_timings){
+        if (t.window.count() == 0) continue;
+        // A stage on one thread uses at most its wall time; anything more
+        // was spent in code between the stages.
+        const double share = static_cast<double>(t.window.count()) / static_cast<double>(m_window.count());
+        t.cpu += std::min(t.window, std::chrono::nanoseconds(static_cast<int64_t>(used * share)));
+        t.window = {};
+    }
+    m_window = {};
+}
+
+void PassManager::report(std::ostream& out) const {
+    std::chrono::nanoseconds total{0};
+    for (const Timing& t : m_timings) total += t.total;
+    out << std::left << std::setw(16) << "pass" << std::right << std::setw(10) << "runs" << std::setw(14) << "ms";
+    if (m_cpu) out << std::setw(14) << "cpu ms";
+    out << std::setw(8) << "%" << '\n';
+    for (const Timing& t : m_timings){
+        const double ms = static_cast<double>(t.total.count()) / 1e6;
+        const double share = total.count() ? 100.0 * static_cast<double>(t.total.count()) / static_cast<double>(total.count()) : 0;
+        out << std::left << std::setw(16) << t.name << std::right << std::setw(10) << t.runs
+            << std::setw(14) << std::fixed << std::setprecision(3) << ms;
+        if (m_cpu) out << std::setw(14) << static_cast<double>(t.cpu.count()) / 1e6;
+        out << std::setw(8) << std::setprecision(1) << share << '\n';
+    }
+}
+
+void add_passes(PassManager& pm, int opt_level){
+    if (opt_level >= 1) {
+        pm.add("const-fold", fold_constants);
+        pm.add("dce", eliminate_dead_code);
+    }
+}
+
+// Takes pred out of block's predecessors, along with its column in the
+// block's phis.
+static void remove_pred(IrFunction& fn, BlockId block, BlockId pred){
+    IrBlock& target = fn.blocks[block];
+    const auto it = std::find(target.preds.begin(), target.preds.end(), pred);
+    if (it == target.preds.end()) return;
+    const size_t column = static_cast<size_t>(it - target.preds.begin());
+    target.preds.erase(it);
+    for (IrInst& inst : target.insts){
+        if (inst.op != IrOp::phi) break;
+        VReg* args = fn.phi_args.data() + inst.a;
+        std::copy(args + column + 1, args + inst.b, args + column);
+        --inst.b;
+    }
+}
+
+static bool fold_binary(IrOp op, uint64_t lhs, uint64_t rhs, uint64_t& out){
+    switch (op){
+        case IrOp::add: out = lhs + rhs; return true;
+        case IrOp::sub: out = lhs - rhs; return true;
+        case IrOp::mul: out = lhs * rhs; return true;
+        // division by zero has to trap at run time
+        case IrOp::div: if (rhs == 0) return false; out = lhs / rhs; return true;
+        case IrOp::eq: out = lhs == rhs; return true;
+        default: return false;
+    }
+}
+
+void fold_constants(IrFunction& fn){
+    std::vector<VReg> repl(fn.vreg_count);
+    std::iota(repl.begin(), repl.end(), 0);
+    std::vector<uint8_t> known(fn.vreg_count, 0);
+    std::vector<uint64_t> value(fn.vreg_count, 0);
+
+    for (BlockId id = 0; id < fn.blocks.size(); ++id){
+        IrBlock& block = fn.blocks[id];
+        if (id != 0 && block.preds.empty()) block.dead = true;
+        BlockId succs[2];
+        if (block.dead) {
+            for (size_t i = 0; i < fn.successors(block, succs); ++i) remove_pred(fn, succs[i], id);
+            continue;
+        }
+        size_t keep = 0;
+        for (size_t i = 0; i < block.insts.size(); ++i){
+            IrInst inst = block.insts[i];
+            switch (inst.op){
+                case IrOp::const_:
+                    known[inst.dst] = 1;
+                    value[inst.dst] = inst.imm;
+                    break;
+                case IrOp::phi: {
+                    VReg* args = fn.phi_args.data() + inst.a;
+                    for (size_t k = 0; k < inst.b; ++k) args[k] = repl[args[k]];
+                    if (std::all_of(args, args + inst.b, [&](VReg v){ return v == args[0]; })) {
+                        repl[inst.dst] = args[0];
+                        continue;
+                    }
+                    if (std::all_of(args, args + inst.b, [&](VReg v){ return known[v] && value[v] == value[args[0]]; })) {
+                        inst = {.op = IrOp::const_, .dst = inst.dst, .a = k_no_vreg, .b = k_no_vreg, .imm = value[args[0]]};
+                        known[inst.dst] = 1;
+                        value[inst.dst] = inst.imm;
+                    }
+                    break;
+                }
+                case IrOp::store:
+                case IrOp::exit:
+                    inst.a = repl[inst.a];
+                    break;
+                case IrOp::branch:
+                    inst.a = repl[inst.a];
+                    if (known[inst.a]) {
+                        const BlockId taken = value[inst.a] ? static_cast<BlockId>(inst.imm) : inst.b;
+                        const BlockId other = value[inst.a] ? inst.b : static_cast<BlockId>(inst.imm);
+                        remove_pred(fn, other, id);
+                        inst = {.op = IrOp::jump, .dst = k_no_vreg, .a = k_no_vreg, .b = k_no_vreg, .imm = taken};
+                    }
+                    break;
+                default:
+                    if (is_binary(inst.op)) {
+                        inst.a = repl[inst.a];
+                        inst.b = repl[inst.b];
+                        uint64_t folded = 0;
+                        if (known[inst.a] && known[inst.b] && fold_binary(inst.op, value[inst.a], value[inst.b], folded)) {
+                            inst = {.op = IrOp::const_, .dst = inst.dst, .a = k_no_vreg, .b = k_no_vreg, .imm = folded};
+                            known[inst.dst] = 1;
+                            value[inst.dst] = folded;
+                        }
+                    }
+                    break;
+            }
+            block.insts[keep++] = inst;
+        }
+        block.insts.resize(keep);
+    }
+}
+
+void eliminate_dead_code(IrFunction& fn){
+    std::vector<uint32_t> uses(fn.vreg_count, 0);
+    std::vector<uint8_t> nonzero(fn.vreg_count, 0);     // defined as a constant other than 0
+    for (const IrBlock& block : fn.blocks){
+        if (block.dead) continue;
+        for (const IrInst& inst : block.insts){
+            if (inst.op == IrOp::const_) nonzero[inst.dst] = inst.imm != 0;
+            else if (inst.op == IrOp::phi) for (const VReg arg : fn.args(inst)) uses[arg]++;
+            else if (is_binary(inst.op)) uses[inst.a]++, uses[inst.b]++;
+            else if (inst.op == IrOp::store || inst.op == IrOp::exit || inst.op == IrOp::branch) uses[inst.a]++;
+        }
+    }
+
+    // The layout is a topological order, so walking it backwards reaches
+    // every use of a value before its definition: one sweep removes whole
+    // chains of dead instructions.
+    std::unordered_set<uint64_t> stored_later;
+    for (BlockId id = static_cast<BlockId>(fn.blocks.size()); id-- > 0;){
+        IrBlock& block = fn.blocks[id];
+        if (block.dead) continue;
+        stored_later.clear();
+        std::vector<IrInst>& insts = block.insts;
+        size_t keep = insts.size();
+        for (size_t i = insts.size(); i-- > 0;){
+            const IrInst& inst = insts[i];
+            bool dead = false;
+            switch (inst.op){
+                case IrOp::const_:
+                case IrOp::load:
+                    dead = uses[inst.dst] == 0;
+                    if (!dead && inst.op == IrOp::load) stored_later.erase(inst.imm);
+                    break;
+                case IrOp::phi:
+                    dead = uses[inst.dst] == 0;
+                    if (dead) for (const VReg arg : fn.args(inst)) uses[arg]--;
+                    break;
+                case IrOp::store:
+                    // overwritten further down the block before anything reads it
+                    dead = !stored_later.insert(inst.imm).second;
+                    if (dead) uses[inst.a]--;
+                    break;
+                default:
+                    // a division that may be by zero has to stay and trap
+                    if (is_binary(inst.op) && uses[inst.dst] == 0 && (inst.op != IrOp::div || nonzero[inst.b])) {
+                        dead = true;
+                        uses[inst.a]--;
+                        uses[inst.b]--;
+                    }
+                    break;
+            }
+            if (!dead) insts[--keep] = inst;
+        }
+        insts.erase(insts.begin(), insts.begin() + static_cast<std::ptrdiff_t>(keep));
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+#include "ir.hpp"
+#include "trace.hpp"
+
+// Runs IR passes in order and accumulates how long each one (and each
+// stage timed through time()) took, over every function it has seen.
+//
+// Instrumented for --stats, it also measures CPU time. Reading a thread's
+// CPU clock is a system call, too slow to make around every stage of a
+// streaming compile, so the clock is read once per millisecond or so of
+// timed work and what was used is shared among the stages timed since, in
+// proportion to their wall time: exact for long stages, an estimate for
+// short ones that take turns.
+class PassManager{
+public:
+    using Pass = void (*)(IrFunction&);
+
+    void add(const char* name, Pass pass);
+
+    void run(IrFunction& fn);
+
+    // Times a stage that is not an IR pass, e.g. building or lowering.
+    template <typename F>
+    void time(const char* name, F&& stage){
+        const auto start = std::chrono::steady_clock::now();
+        stage();
+        const auto end = std::chrono::steady_clock::now();
+        record(name, end - start);
+        if (m_trace && end - start >= Trace::k_min_span) m_trace->span(name, start, end);
+    }
+
+    // Times a stage run by another process, e.g. nasm. Its CPU time comes
+    // from record_cpu, so the wait stays out of the share of this thread's
+    // CPU time that the stages around it get.
+    template <typename F>
+    void time_tool(const char* name, F&& tool){
+        settle_cpu();
+        const auto start = std::chrono::steady_clock::now();
+        tool();
+        const auto end = std::chrono::steady_clock::now();
+        record_external(name, end - start);
+        if (m_trace && end - start >= Trace::k_min_span) m_trace->span(name, start, end);
+    }
+
+    // Adds a stage timed by hand, e.g. with waits left out.
+    void record(const char* name, std::chrono::nanoseconds elapsed);
+
+    // CPU time spent for a stage outside this thread, e.g. by nasm.
+    void record_cpu(const char* name, std::chrono::nanoseconds cpu);
+
+    // Adds other's timings to these, e.g. those of a stage that ran on
+    // another thread.
+    void merge(const PassManager& other);
+
+    // From now on measures CPU time (on the calling thread, the one that
+    // times stages here) and sends the stages to trace as spans; either
+    // can be off.
+    void instrument(bool cpu, Trace* trace);
+
+    bool measures_cpu() const {
+        return m_cpu;
+    }
+
+    Trace* trace() const {
+        return m_trace;
+    }
+
+    // Hands out the CPU time used since the clock was last read; done
+    // before the timings are reported or merged.
+    void settle_cpu();
+
+    // one line per pass / stage, in the order they first ran, with the CPU
+    // time if it was measured
+    void report(std::ostream& out) const;
+private:
+    struct Entry{
+        const char* name;
+        Pass pass;
+    };
+    struct Timing{
+        const char* name;
+        std::chrono::nanoseconds total;
+        uint64_t runs;
+        std::chrono::nanoseconds cpu{0};
+        std::chrono::nanoseconds window{0};     // timed since the CPU clock was last read
+    };
+
+    static constexpr std::chrono::milliseconds k_cpu_window{1};
+
+    Timing& timing(const char* name);
+    void record_external(const char* name, std::chrono::nanoseconds elapsed);
+
+    std::vector<Entry> m_passes;
+    std::vector<Timing> m_timings;
+    bool m_cpu = false;
+    Trace* m_trace = nullptr;
+    std::chrono::nanoseconds m_cpu_mark{0};     // the thread's CPU clock when last read
+    std::chrono::nanoseconds m_window{0};
+};
+
+// The pipeline of an optimization level.
+void add_passes(PassManager& pm, int opt_level);
+
+// Folds instructions whose operands are constants, phis whose incoming
+// values all agree and branches on constants; blocks that can no longer be
+// reached are marked dead and dropped from the phis they fed.
+void fold_constants(IrFunction& fn);
+
+// Removes instructions whose value is never used (keeping divisions that
+// may trap) and stores to a slot that the same block overwrites before
+// reading it.
+void eliminate_dead_code(IrFunction& fn);
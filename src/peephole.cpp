@@ -0,0 +1,324 @@
+#include "peephole.hpp"
+#include <iomanip>
+#include <ostream>
+
+static bool is_reg(const MOperand& op, Reg reg){
+    return op.is_reg() && op.reg == reg;
+}
+
+static bool is_scratch(Reg reg){
+    return reg == Reg::rax || reg == Reg::rdx || reg == Reg::r11;
+}
+
+static bool ends_block(MOp op){
+    return op == MOp::label || op == MOp::jmp || op == MOp::jz || op == MOp::jnz || op == MOp::syscall || op == MOp::ret;
+}
+
+// every flag reader the generator emits looks at ZF only
+static bool reads_flags(MOp op){
+    return op == MOp::sete || op == MOp::jz || op == MOp::jnz;
+}
+
+static bool writes_flags(MOp op){
+    switch (op){
+        case MOp::add:
+        case MOp::sub:
+        case MOp::imul:
+        case MOp::mul:
+        case MOp::shl:
+        case MOp::shr:
+        case MOp::neg:
+        case MOp::xor_:
+        case MOp::cmp:
+        case MOp::test:
+        case MOp::div:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool reads_reg(const MInst& inst, Reg reg){
+    switch (inst.op){
+        case MOp::mov:
+        case MOp::movzx:
+            return is_reg(inst.src, reg);
+        case MOp::xor_:
+            if (inst.dst == inst.src) return false;
+            return is_reg(inst.dst, reg) || is_reg(inst.src, reg);
+        case MOp::add:
+        case MOp::sub:
+        case MOp::imul:
+        case MOp::cmp:
+        case MOp::test:
+            return is_reg(inst.dst, reg) || is_reg(inst.src, reg);
+        case MOp::lea:
+            return inst.src.reg == reg || inst.src.index == reg;
+        case MOp::shl:
+        case MOp::shr:
+        case MOp::neg:
+        case MOp::push:
+            return is_reg(inst.dst, reg);
+        case MOp::mul:
+            return reg == Reg::rax || is_reg(inst.dst, reg);
+        case MOp::div:
+            return reg == Reg::rax || reg == Reg::rdx || is_reg(inst.dst, reg);
+        case MOp::syscall:
+            return reg == Reg::rax || reg == Reg::rdi || reg == Reg::rsi || reg == Reg::rdx
+                || reg == Reg::r10 || reg == Reg::r8 || reg == Reg::r9;
+        case MOp::ret:
+            return reg == Reg::rax;
+        default:
+            return false;
+    }
+}
+
+// Whether inst leaves nothing of reg's old value. sete only sets al, but
+// the generator reads nothing but al after it.
+static bool writes_reg(const MInst& inst, Reg reg){
+    switch (inst.op){
+        case MOp::mov:
+        case MOp::movzx:
+        case MOp::add:
+        case MOp::sub:
+        case MOp::imul:
+        case MOp::lea:
+        case MOp::shl:
+        case MOp::shr:
+        case MOp::neg:
+        case MOp::xor_:
+        case MOp::pop:
+            return is_reg(inst.dst, reg);
+        case MOp::mul:
+        case MOp::div:
+            return reg == Reg::rax || reg == Reg::rdx;
+        case MOp::sete:
+            return reg == Reg::rax;
+        case MOp::syscall:
+            return reg == Reg::rax || reg == Reg::rcx || reg == Reg::r11;
+        default:
+            return false;
+    }
+}
+
+static bool writes_mem(const MInst& inst, uint32_t offset){
+    if (inst.op == MOp::cmp || inst.op == MOp::test || inst.op == MOp::push || inst.op == MOp::mul || inst.op == MOp::div) return false;
+    return inst.dst.is_mem() && inst.dst.offset == offset;
+}
+
+static bool moves_rsp(const MInst& inst){
+    return inst.op == MOp::push || inst.op == MOp::pop || is_reg(inst.dst, Reg::rsp);
+}
+
+static bool is_stack_adjust(const MInst& inst){
+    return (inst.op == MOp::add || inst.op == MOp::sub) && is_reg(inst.dst, Reg::rsp) && inst.src.is_imm();
+}
+
+void Peephole::run(std::vector<MInst>& code){
+    m_code = &code;
+    m_removed.assign(code.size(), 0);
+    // a rewrite can expose another one further back, so go over it again
+    // while anything changes
+    for (int round = 0; round < 4; ++round){
+        bool changed = false;
+        for (size_t i = 0; i < code.size(); ++i){
+            if (!m_removed[i] && rewrite(i)) changed = true;
+        }
+        if (!changed) break;
+    }
+    size_t out = 0;
+    for (size_t i = 0; i < code.size(); ++i){
+        if (!m_removed[i]) code[out++] = code[i];
+    }
+    code.resize(out);
+    m_code = nullptr;
+}
+
+size_t Peephole::next(size_t i) const {
+    do {
+        ++i;
+    } while (i < m_removed.size() && m_removed[i]);
+    return i;
+}
+
+void Peephole::remove(size_t i){
+    m_removed[i] = 1;
+}
+
+void Peephole::hit(Rule rule, int64_t saved){
+    m_hits[rule]++;
+    m_saved[rule] += saved;
+}
+
+// Scratch registers never carry a value into another block; anything else
+// is assumed to.
+bool Peephole::reg_dead_after(size_t i, Reg reg) const {
+    const std::vector<MInst>& code = *m_code;
+    for (size_t k = next(i); k < code.size(); k = next(k)){
+        if (reads_reg(code[k], reg)) return false;
+        if (writes_reg(code[k], reg)) return true;
+        if (ends_block(code[k].op)) return is_scratch(reg);
+    }
+    return is_scratch(reg);
+}
+
+bool Peephole::flags_dead_after(size_t i) const {
+    const std::vector<MInst>& code = *m_code;
+    for (size_t k = next(i); k < code.size(); k = next(k)){
+        if (reads_flags(code[k].op)) return false;
+        if (writes_flags(code[k].op) || ends_block(code[k].op)) return true;
+    }
+    return true;
+}
+
+bool Peephole::rewrite(size_t i){
+    std::vector<MInst>& code = *m_code;
+    MInst& inst = code[i];
+    const size_t j = next(i);
+    MInst* second = j < code.size() ? &code[j] : nullptr;
+    const MOperand rax = reg_op(Reg::rax);
+    switch (inst.op){
+        case MOp::push:
+            if (!second || second->op != MOp::pop) return false;
+            if (inst.dst == second->dst) {
+                remove(i);
+                remove(j);
+                hit(push_pop, 2);
+                return true;
+            }
+            if (inst.dst.is_mem() && second->dst.is_mem()) return false;
+            inst = {.op = MOp::mov, .dst = second->dst, .src = inst.dst};
+            remove(j);
+            hit(push_pop, 1);
+            return true;
+
+        case MOp::add:
+        case MOp::sub: {
+            if (!is_stack_adjust(inst)) return false;
+            if (inst.src.imm == 0) {
+                remove(i);
+                hit(stack_adjust, 1);
+                return true;
+            }
+            if (!second || !is_stack_adjust(*second)) return false;
+            const auto delta = [](const MInst& adjust){
+                const int64_t bytes = static_cast<int64_t>(adjust.src.imm);
+                return adjust.op == MOp::add ? bytes : -bytes;
+            };
+            const int64_t total = delta(inst) + delta(*second);
+            remove(j);
+            if (total == 0) {
+                remove(i);
+                hit(stack_adjust, 2);
+            } else {
+                inst.op = total > 0 ? MOp::add : MOp::sub;
+                inst.src = imm_op(static_cast<uint64_t>(total > 0 ? total : -total));
+                hit(stack_adjust, 1);
+            }
+            return true;
+        }
+
+        case MOp::mov:
+            if (inst.dst == inst.src && (!inst.dst.is_reg() || inst.dst.size == 8)) {
+                remove(i);
+                hit(self_move, 1);
+                return true;
+            }
+            if (inst.dst.is_mem() && inst.src.is_reg()) return forward_store(i);
+            if (inst.dst == rax && second && (fold_cmp(i, j) || fold_sub(i, j))) return true;
+            if (inst.dst.is_reg() && inst.dst.size == 8 && inst.src == imm_op(0) && flags_dead_after(i)) {
+                inst = {.op = MOp::xor_, .dst = reg_op(inst.dst.reg, 4), .src = reg_op(inst.dst.reg, 4)};
+                hit(zero_xor, 0);
+                return true;
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+// mov rax, imm; cmp rax, x -> cmp x, imm. The order of cmp's operands
+// does not matter to ZF, the only flag that is read.
+bool Peephole::fold_cmp(size_t i, size_t j){
+    MInst& inst = (*m_code)[i];
+    const MInst& cmp = (*m_code)[j];
+    if (!inst.src.is_imm() || inst.src.is_wide_imm() || cmp.op != MOp::cmp || cmp.dst != reg_op(Reg::rax)) return false;
+    if (!cmp.src.is_mem() && !(cmp.src.is_reg() && cmp.src.reg != Reg::rax)) return false;
+    if (!reg_dead_after(j, Reg::rax)) return false;
+    inst = {.op = MOp::cmp, .dst = cmp.src, .src = inst.src};
+    remove(j);
+    hit(cmp_imm, 1);
+    return true;
+}
+
+// mov rax, a; sub rax, b; mov b, rax -> neg b; add b, a
+bool Peephole::fold_sub(size_t i, size_t j){
+    std::vector<MInst>& code = *m_code;
+    const MOperand rax = reg_op(Reg::rax);
+    const MOperand a = code[i].src;
+    const MOperand b = code[j].src;
+    if (code[j].op != MOp::sub || code[j].dst != rax || !b.is_reg() || b.size != 8 || b.reg == Reg::rax) return false;
+    if (a.is_wide_imm() || is_reg(a, b.reg)) return false;
+    const size_t k = next(j);
+    if (k >= code.size() || code[k].op != MOp::mov || code[k].dst != b || code[k].src != rax) return false;
+    if (!reg_dead_after(k, Reg::rax) || !flags_dead_after(k)) return false;
+    code[i] = {.op = MOp::neg, .dst = b, .src = {}};
+    code[j] = {.op = MOp::add, .dst = b, .src = a};
+    remove(k);
+    hit(sub_neg, 1);
+    return true;
+}
+
+// mov [m], r: later reads of [m] in the same block can use r instead, as
+// long as neither r nor [m] (nor rsp) has changed in between.
+bool Peephole::forward_store(size_t i){
+    std::vector<MInst>& code = *m_code;
+    const MOperand mem = code[i].dst;
+    const MOperand reg = code[i].src;
+    if (reg.size != 8) return false;
+    bool changed = false;
+    for (size_t k = next(i); k < code.size(); k = next(k)){
+        MInst& inst = code[k];
+        if (ends_block(inst.op) || moves_rsp(inst)) break;
+        if (inst.src == mem) {
+            switch (inst.op){
+                case MOp::mov:
+                    if (inst.dst == reg) {
+                        remove(k);
+                        hit(store_load, 1);
+                        changed = true;
+                        continue;
+                    }
+                    [[fallthrough]];
+                case MOp::add:
+                case MOp::sub:
+                case MOp::imul:
+                case MOp::cmp:
+                    inst.src = reg;
+                    hit(store_load, 0);
+                    changed = true;
+                    break;
+                default:
+                    break;
+            }
+        } else if (inst.dst == mem && (inst.op == MOp::cmp || inst.op == MOp::mul || inst.op == MOp::div)) {
+            inst.dst = reg;
+            hit(store_load, 0);
+            changed = true;
+        }
+        if (writes_reg(inst, reg.reg) || writes_mem(inst, mem.offset)) break;
+    }
+    return changed;
+}
+
+void Peephole::report(std::ostream& out) const {
+    static constexpr const char* names[] = {
+        "push-pop", "store-load", "self-move", "zero-xor", "stack-adjust", "sub-neg", "cmp-imm",
+    };
+    out << std::left << std::setw(16) << "rule" << std::right << std::setw(10) << "hits" << std::setw(14) << "insts saved" << '\n';
+    for (size_t rule = 0; rule < rule_count; ++rule){
+        out << std::left << std::setw(16) << names[rule] << std::right << std::setw(10) << m_hits[rule]
+            << std::setw(14) << m_saved[rule] << '\n';
+    }
+}
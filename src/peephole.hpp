@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+#include "machine.hpp"
+
+// Rewrites short windows of generated machine code. Besides the generator's
+// own conventions (rax, rdx and r11 are scratch registers and flags are
+// never live across a label or a jump) it assumes nothing about the code,
+// and every rule counts how often it fired, over every run.
+class Peephole{
+public:
+    enum Rule : uint8_t {
+        push_pop,       // push x; pop y          -> mov y, x
+        store_load,     // mov [m], r; ...; [m]   -> r
+        self_move,      // mov x, x               ->
+        zero_xor,       // mov r, 0               -> xor r32, r32
+        stack_adjust,   // add rsp, a; sub rsp, b -> one adjustment, or none
+        sub_neg,        // mov rax, a; sub rax, b; mov b, rax -> neg b; add b, a
+        cmp_imm,        // mov rax, imm; cmp rax, x           -> cmp x, imm
+        rule_count,
+    };
+
+    void run(std::vector<MInst>& code);
+
+    uint64_t hits(Rule rule) const {
+        return m_hits[rule];
+    }
+
+    // one line per rule: how often it fired and how many instructions that
+    // saved
+    void report(std::ostream& out) const;
+private:
+    bool rewrite(size_t i);
+    bool forward_store(size_t i);
+    bool fold_cmp(size_t i, size_t j);
+    bool fold_sub(size_t i, size_t j);
+
+    // next instruction after i that has not been removed, or m_code->size()
+    size_t next(size_t i) const;
+    void remove(size_t i);
+    bool reg_dead_after(size_t i, Reg reg) const;
+    bool flags_dead_after(size_t i) const;
+    void hit(Rule rule, int64_t saved);
+
+    std::vector<MInst>* m_code = nullptr;
+    std::vector<uint8_t> m_removed;
+    std::array<uint64_t, rule_count> m_hits{};
+    std::array<int64_t, rule_count> m_saved{};
+};
@@ -0,0 +1,139 @@
+#include "pipeline.hpp"
+#include "error.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <cstring>
+
+// statements go to the generator in batches of about this many nodes
+static constexpr size_t k_batch_nodes = 4096;
+
+ParsePipeline::ParsePipeline(Tokenizer& tokenizer, const PassManager& passes)
+    : m_measure_cpu(passes.measures_cpu()), m_trace(passes.trace()),
+      m_lexer([this, &tokenizer] { run_stage("lexer", m_lex_timings, [&]{ lex(tokenizer); }); }),
+      m_parser([this] { run_stage("parser", m_parse_timings, [&]{ parse(); }); }) {}
+
+ParsePipeline::~ParsePipeline(){
+    m_tokens.close();
+    m_stmts.close();
+    join();
+}
+
+template <typename F>
+void ParsePipeline::run_stage(const char* name, PassManager& timings, F&& stage){
+    timings.instrument(m_measure_cpu, m_trace);
+    if (m_trace) m_trace->name_thread(name);
+    stage();
+    timings.settle_cpu();
+}
+
+void ParsePipeline::join(){
+    if (m_lexer.joinable()) m_lexer.join();
+    if (m_parser.joinable()) m_parser.join();
+}
+
+// Cuts the source into the same batches as a serial compile, whose parser
+// also reads k_batch_size tokens at a time, so a lexing error reaches the
+// parser at the same point.
+void ParsePipeline::lex(Tokenizer& tokenizer){
+    while (true) {
+        TokenBatch* batch = m_tokens.write();
+        if (!batch) return;
+        batch->error = nullptr;
+        try {
+            m_lex_timings.time("lex", [&]{ batch->count = tokenizer.read(batch->tokens.data(), batch->tokens.size()); });
+        } catch (...) {
+            batch->count = 0;
+            batch->error = std::current_exception();
+        }
+        const bool last = batch->count == 0;
+        m_tokens.push();
+        if (last) return;
+    }
+}
+
+size_t ParsePipeline::RingSource::read(Token* out, size_t max){
+    const auto start = std::chrono::steady_clock::now();
+    TokenBatch* batch = m_ring.read();
+    waited += std::chrono::steady_clock::now() - start;
+    if (!batch) throw Stopped{};
+    if (batch->error) std::rethrow_exception(batch->error);
+    const size_t count = std::min(max, batch->count - m_offset);
+    std::memcpy(out, batch->tokens.data() + m_offset, count * sizeof(Token));
+    m_offset += count;
+    // the end of the source stays at the front for any later read
+    if (m_offset == batch->count && batch->count) {
+        m_offset = 0;
+        m_ring.pop();
+    }
+    return count;
+}
+
+void ParsePipeline::parse(){
+    RingSource source(m_tokens);
+    Ast ast;
+    std::vector<NodeId> stmts;
+    Parser parser(source, ast);
+    while (true) {
+        parser.release_nodes();
+        stmts.clear();
+        bool end = false;
+        std::exception_ptr error;
+        const auto start = std::chrono::steady_clock::now();
+        source.waited = {};
+        try {
+            while (ast.node_count() < k_batch_nodes) {
+                if (parser.at_end()) {
+                    end = true;
+                    break;
+                }
+                const std::optional<NodeId> stmt = parser.parse_stmt();
+                if (!stmt) {
+                    throw CompileError("invalid statement");
+                }
+                stmts.push_back(stmt.value());
+            }
+        } catch (const Stopped&) {
+            return;
+        } catch (...) {
+            error = std::current_exception();
+        }
+        const auto stop = std::chrono::steady_clock::now();
+        m_parse_timings.record("parse", stop - start - source.waited);
+        // the span takes in the waits for tokens
+        if (m_trace && stop - start >= Trace::k_min_span) m_trace->span("parse", start, stop);
+
+        StmtBatch* batch = m_stmts.write();
+        if (!batch) return;
+        std::swap(batch->ast, ast);
+        std::swap(batch->stmts, stmts);
+        batch->end = end || error;
+        batch->error = error;
+        m_stmts.push();
+        if (end || error) return;
+    }
+}
+
+bool ParsePipeline::next(Ast& ast, std::vector<NodeId>& stmts){
+    if (m_error) {
+        const std::exception_ptr error = m_error;
+        m_error = nullptr;
+        std::rethrow_exception(error);
+    }
+    if (m_done) return false;
+    // the statement ring is only closed from this side
+    StmtBatch* batch = m_stmts.read();
+    std::swap(batch->ast, ast);
+    std::swap(batch->stmts, stmts);
+    m_error = batch->error;
+    m_done = batch->end;
+    m_stmts.pop();
+    if (m_done) {
+        // after a parse error the lexer may still be waiting to hand over
+        // tokens nobody is going to read
+        m_tokens.close();
+        join();
+        m_timings.merge(m_lex_timings);
+        m_timings.merge(m_parse_timings);
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <exception>
+#include <thread>
+#include <vector>
+#include "ast.hpp"
+#include "passes.hpp"
+#include "ring.hpp"
+#include "tokenization.hpp"
+
+// The front end of a pipelined compile. The tokenizer and the parser each
+// run on a thread of their own: token batches go from one to the other
+// through a ring, and parsed top-level statements come out of a second
+// ring on the calling thread, which generates code from them meanwhile.
+// Full rings hold the earlier stages back, so memory stays bounded.
+//
+// An error stops the stage it happens in and travels down the rings in
+// its place in the program. Everything before it still reaches the caller
+// first, so the error reported is the one a serial compile would report.
+class ParsePipeline{
+public:
+    // The threads' timings are instrumented like passes.
+    ParsePipeline(Tokenizer& tokenizer, const PassManager& passes);
+    // stops both threads if they are still running
+    ~ParsePipeline();
+
+    ParsePipeline(const ParsePipeline&) = delete;
+    ParsePipeline& operator=(const ParsePipeline&) = delete;
+
+    // Swaps the next batch of statements into ast, handing ast's old
+    // contents back to the parser for reuse, and lists them in stmts.
+    // Returns false at the end of the program; throws an error of the
+    // lexer or the parser once the statements before it are out.
+    bool next(Ast& ast, std::vector<NodeId>& stmts);
+
+    // "lex" and "parse" times, once next() has returned false
+    const PassManager& timings() const {
+        return m_timings;
+    }
+private:
+    struct TokenBatch{
+        std::array<Token, Tokenizer::k_batch_size> tokens;
+        size_t count = 0;               // 0 at the end of the source
+        std::exception_ptr error;
+    };
+
+    struct StmtBatch{
+        Ast ast;
+        std::vector<NodeId> stmts;
+        bool end = false;
+        std::exception_ptr error;       // raised after stmts
+    };
+
+    // The parser's view of the token ring.
+    class RingSource final : public TokenSource{
+    public:
+        explicit RingSource(SpscRing<TokenBatch, 16>& ring) : m_ring(ring) {}
+        size_t read(Token* out, size_t max) override;
+
+        std::chrono::nanoseconds waited{0};
+    private:
+        SpscRing<TokenBatch, 16>& m_ring;
+        size_t m_offset = 0;            // into the batch at the front of the ring
+    };
+
+    // thrown on the parser thread when the pipeline is being torn down
+    struct Stopped{};
+
+    // runs a stage on its thread, with its timings instrumented
+    template <typename F>
+    void run_stage(const char* name, PassManager& timings, F&& stage);
+
+    void lex(Tokenizer& tokenizer);
+    void parse();
+    void join();
+
+    SpscRing<TokenBatch, 16> m_tokens;
+    SpscRing<StmtBatch, 4> m_stmts;
+    PassManager m_lex_timings;
+    PassManager m_parse_timings;
+    PassManager m_timings;
+    std::exception_ptr m_error;         // to raise on the next call to next()
+    bool m_done = false;
+    const bool m_measure_cpu;
+    Trace* const m_trace;
+    std::thread m_lexer;
+    std::thread m_parser;
+};
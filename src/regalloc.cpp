@@ -0,0 +1,110 @@
+#include "regalloc.hpp"
+#include <algorithm>
+
+const char* reg_name(Reg reg){
+    static constexpr const char* names[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    };
+    return names[static_cast<uint8_t>(reg)];
+}
+
+LinearScan::LinearScan(std::span<const Reg> pool) : m_pool(pool.rbegin(), pool.rend()) {}
+
+std::vector<Reg> LinearScan::run(std::span<const LiveInterval> intervals){
+    std::vector<Reg> result(intervals.size(), Reg::none);
+    std::vector<Reg> free = m_pool;
+    // indices into intervals, sorted by increasing end
+    std::vector<uint32_t> active;
+    const auto by_end = [&](uint32_t a, uint32_t b){ return intervals[a].end < intervals[b].end; };
+
+    for (uint32_t i = 0; i < intervals.size(); ++i){
+        const LiveInterval& cur = intervals[i];
+        size_t expired = 0;
+        while (expired < active.size() && intervals[active[expired]].end < cur.start){
+            free.push_back(result[active[expired]]);
+            ++expired;
+        }
+        active.erase(active.begin(), active.begin() + static_cast<std::ptrdiff_t>(expired));
+
+        if (free.empty()){
+            // spill whichever of cur and the active intervals ends last
+            if (active.empty()) continue;
+            const uint32_t last = active.back();
+            if (intervals[last].end <= cur.end) continue;
+            result[i] = result[last];
+            result[last] = Reg::none;
+            active.pop_back();
+        } else {
+            result[i] = free.back();
+            free.pop_back();
+        }
+        active.insert(std::upper_bound(active.begin(), active.end(), i, by_end), i);
+    }
+    return result;
+}
+
+bool is_direct_operand(const Ast& ast, const nodeExpr& bin_expr){
+    const nodeExpr& rhs = ast.expr(bin_expr.rhs);
+    if (rhs.kind == ExprKind::ident) return true;
+    // div has no immediate form
+    return rhs.kind == ExprKind::int_lit && bin_expr.kind != ExprKind::div && ast.int_value(rhs) <= INT32_MAX;
+}
+
+std::vector<uint8_t> label_register_need(const Ast& ast){
+    std::vector<uint8_t> need(ast.exprs.size(), 1);
+    for (NodeId id = 0; id < ast.exprs.size(); ++id){
+        const nodeExpr& node = ast.expr(id);
+        if (!is_bin_expr(node.kind)) continue;
+        const int lhs = need[node.lhs];
+        const int rhs = is_direct_operand(ast, node) ? 0 : need[node.rhs];
+        need[id] = static_cast<uint8_t>(std::min(lhs == rhs ? lhs + 1 : std::max(lhs, rhs), 255));
+    }
+    return need;
+}
+
+static uint8_t label_expr(const Ast& ast, NodeId id, std::vector<uint8_t>& need){
+    const nodeExpr& node = ast.expr(id);
+    need[id] = 1;
+    if (is_bin_expr(node.kind)) {
+        const int lhs = label_expr(ast, node.lhs, need);
+        const int rhs_need = label_expr(ast, node.rhs, need);
+        const int rhs = is_direct_operand(ast, node) ? 0 : rhs_need;
+        need[id] = static_cast<uint8_t>(std::min(lhs == rhs ? lhs + 1 : std::max(lhs, rhs), 255));
+    }
+    return need[id];
+}
+
+static void label_stmts(const Ast& ast, StmtRange stmts, std::vector<uint8_t>& need);
+
+static void label_stmt(const Ast& ast, NodeId stmt, std::vector<uint8_t>& need){
+    const nodeStmt& node = ast.stmt(stmt);
+    switch (node.kind){
+        case StmtKind::exit:
+        case StmtKind::let:
+        case StmtKind::assign:
+            label_expr(ast, node.expr, need);
+            break;
+        case StmtKind::scope:
+            label_stmts(ast, node.scope, need);
+            break;
+        case StmtKind::if_:
+            label_expr(ast, node.expr, need);
+            label_stmts(ast, node.scope, need);
+            for (NodeId pred = node.pred; pred != k_no_node; pred = ast.pred(pred).next){
+                const nodeIfPred& branch = ast.pred(pred);
+                if (branch.kind == PredKind::elif) label_expr(ast, branch.expr, need);
+                label_stmts(ast, branch.scope, need);
+            }
+            break;
+    }
+}
+
+static void label_stmts(const Ast& ast, StmtRange stmts, std::vector<uint8_t>& need){
+    for (const NodeId stmt : ast.list(stmts)) label_stmt(ast, stmt, need);
+}
+
+void label_register_need(const Ast& ast, NodeId stmt, std::vector<uint8_t>& need){
+    if (need.size() < ast.exprs.size()) need.resize(ast.exprs.size(), 1);
+    label_stmt(ast, stmt, need);
+}
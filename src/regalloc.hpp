@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "ast.hpp"
+
+enum class Reg : uint8_t {
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15,
+    none,   // not in a register: the value lives on the stack
+};
+
+const char* reg_name(Reg reg);
+
+// [start, end] in some linear numbering of definitions and uses; owner is
+// whatever the caller needs to map the result back.
+struct LiveInterval{
+    uint32_t start;
+    uint32_t end;
+    uint32_t owner;
+};
+
+// Poletto/Sarkar linear scan. Intervals must be sorted by start. Returns
+// one register per interval, Reg::none for the ones that were spilled.
+class LinearScan{
+public:
+    explicit LinearScan(std::span<const Reg> pool);
+
+    std::vector<Reg> run(std::span<const LiveInterval> intervals);
+private:
+    std::vector<Reg> m_pool;
+};
+
+// Registers vregs are allocated to. rax, rdx and r11 are left to the code
+// generator: div and sete need rax/rdx, and all three serve as temporaries
+// for operands that cannot be encoded directly.
+inline constexpr Reg k_alloc_regs[] = {
+    Reg::rbx, Reg::rcx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9,
+    Reg::r10, Reg::r12, Reg::r13, Reg::r14, Reg::r15,
+};
+
+// Whether the rhs of a binary expression can be used as an instruction
+// operand as is (a variable, or an immediate that fits in 32 bits), so it
+// never needs a register of its own.
+bool is_direct_operand(const Ast& ast, const nodeExpr& bin_expr);
+
+// Sethi-Ullman numbering: the number of registers each expression needs to
+// be evaluated without spilling, indexed by NodeId. IrBuilder emits the
+// needier operand first. Children are
+// always added before their parents, so one forward sweep is enough.
+std::vector<uint8_t> label_register_need(const Ast& ast);
+
+// The same for the expressions under one statement only; need grows to
+// cover the whole tree, and entries outside the statement are left alone.
+void label_register_need(const Ast& ast, NodeId stmt, std::vector<uint8_t>& need);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+// Bounded single-producer / single-consumer queue of N reusable slots. The
+// producer fills the slot write() hands out and publishes it with push();
+// the consumer reads the slot read() hands out and gives it back with
+// pop(). Slots are never destroyed, so buffers kept in them are reused
+// round after round.
+//
+// A full ring holds the producer back and an empty one the consumer: each
+// spins briefly, then sleeps on a futex until the other side moves.
+// close() wakes both sides for good.
+template <typename T, size_t N>
+class SpscRing{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ring size must be a power of two");
+public:
+    // The next free slot, or nullptr once the ring is closed.
+    T* write(){
+        const uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (!wait_for([&] { return head - m_tail.load(std::memory_order_acquire) < N; })) return nullptr;
+        return &m_slots[head % N];
+    }
+
+    void push(){
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        wake();
+    }
+
+    // The oldest published slot, or nullptr once the ring is closed.
+    T* read(){
+        const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (!wait_for([&] { return m_head.load(std::memory_order_acquire) != tail; })) return nullptr;
+        return &m_slots[tail % N];
+    }
+
+    void pop(){
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        wake();
+    }
+
+    void close(){
+        m_closed.store(true);
+        wake();
+    }
+private:
+    static constexpr int k_spins = 64;
+
+    template <typename Ready>
+    bool wait_for(Ready ready){
+        for (int i = 0; i < k_spins; ++i) {
+            if (m_closed.load(std::memory_order_relaxed)) return false;
+            if (ready()) return true;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#else
+            std::this_thread::yield();
+#endif
+        }
+        while (true) {
+            // The sleeper is counted before the last look: a wake() that
+            // comes after the look then sees it and notifies, and one that
+            // comes before has already changed m_events (all seq_cst).
+            m_sleepers.fetch_add(1);
+            const uint32_t events = m_events.load();
+            const bool closed = m_closed.load();
+            if (closed || ready()) {
+                m_sleepers.fetch_sub(1);
+                return !closed;
+            }
+            m_events.wait(events);
+            m_sleepers.fetch_sub(1);
+        }
+    }
+
+    void wake(){
+        m_events.fetch_add(1);
+        if (m_sleepers.load()) m_events.notify_all();
+    }
+
+    std::array<T, N> m_slots;
+    alignas(64) std::atomic<uint32_t> m_head{0};   // slots published
+    alignas(64) std::atomic<uint32_t> m_tail{0};   // slots given back
+    alignas(64) std::atomic<uint32_t> m_events{0};
+    std::atomic<uint32_t> m_sleepers{0};
+    std::atomic<bool> m_closed{false};
+};
@@ -0,0 +1,252 @@
+#include "server.hpp"
+#include "cache.hpp"
+#include "error.hpp"
+#include "source.hpp"
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Both directions use the same framing: a sequence of records
+// "<key> <length>\n<length bytes>", terminated by the record "end 0\n".
+//
+// request keys:  source_path | source, output, stream, pipeline, opt, emit, peephole
+// response keys: status ("ok" | "error"), diagnostics, time_us
+
+struct Record{
+    std::string key;
+    std::string value;
+};
+
+// Inline sources are the largest records; anything longer is refused
+// before memory is taken for it.
+static constexpr size_t k_max_record = 64 << 20;
+
+// A client that stops sending (or reading) would otherwise hold up the
+// serial accept loop for good.
+static constexpr timeval k_io_timeout{.tv_sec = 10, .tv_usec = 0};
+
+static bool write_all(int fd, const char* data, size_t size){
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool read_exact(int fd, char* data, size_t size){
+    while (size > 0) {
+        const ssize_t n = ::read(fd, data, size);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool send_record(int fd, const std::string& key, std::string_view value){
+    const std::string header = key + ' ' + std::to_string(value.size()) + '\n';
+    return write_all(fd, header.data(), header.size()) && write_all(fd, value.data(), value.size());
+}
+
+// Returns nothing if the peer closed the connection or timed out, and
+// throws CompileError on a record that does not follow the framing.
+static std::optional<Record> recv_record(int fd){
+    std::string header;
+    char c;
+    while (true) {
+        if (!read_exact(fd, &c, 1)) return {};
+        if (c == '\n') break;
+        header.push_back(c);
+        if (header.size() > 64) throw CompileError("malformed request: record header too long");
+    }
+    const size_t space = header.find(' ');
+    if (space == std::string::npos) throw CompileError("malformed request: no record length");
+    Record record{.key = header.substr(0, space), .value = {}};
+    const char* first = header.data() + space + 1;
+    const char* last = header.data() + header.size();
+    size_t size = 0;
+    const auto [end, ec] = std::from_chars(first, last, size);
+    if (first == last || ec != std::errc() || end != last) {
+        throw CompileError("malformed request: bad length for " + record.key);
+    }
+    if (size > k_max_record) {
+        throw CompileError("request record " + record.key + " is " + std::to_string(size) + " bytes, more than the limit of "
+                           + std::to_string(k_max_record));
+    }
+    record.value.resize(size);
+    if (!read_exact(fd, record.value.data(), record.value.size())) return {};
+    return record;
+}
+
+static sockaddr_un socket_address(const std::string& path){
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) throw CompileError("socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+static volatile std::sig_atomic_t g_stop = 0;
+
+static void handle_stop(int){
+    g_stop = 1;
+}
+
+static void serve_connection(int fd, CompileContext& ctx){
+    std::optional<std::string> source_path;
+    std::optional<std::string> source;
+    std::string output;
+    CompileOptions options;
+
+    std::string status = "ok";
+    std::string diagnostics;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        while (true) {
+            auto record = recv_record(fd);
+            if (!record) throw CompileError("request ended early or timed out");
+            if (record->key == "end") break;
+            if (record->key == "source_path") source_path = std::move(record->value);
+            else if (record->key == "source") source = std::move(record->value);
+            else if (record->key == "output") output = std::move(record->value);
+            else if (record->key == "stream") options.streaming = record->value == "1";
+            else if (record->key == "pipeline") options.pipelined = record->value == "1";
+            else if (record->key == "opt") options.opt_level = std::atoi(record->value.c_str());
+            else if (record->key == "emit") options.emit = record->value == "ir" ? Emit::ir : record->value == "asm" ? Emit::assembly
+                                                         : record->value == "bc" ? Emit::bytecode : Emit::binary;
+            else if (record->key == "peephole") options.peephole = record->value == "1";
+        }
+        if (output.empty() || (!source_path && !source)) throw CompileError("malformed request");
+        start = std::chrono::steady_clock::now();
+        if (source) compile_source(*source, output, options, ctx);
+        else compile_file(*source_path, output, options, ctx);
+    } catch (const std::exception& err) {
+        status = "error";
+        diagnostics = err.what();
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    send_record(fd, "status", status);
+    send_record(fd, "diagnostics", diagnostics);
+    send_record(fd, "time_us", std::to_string(elapsed.count()));
+    send_record(fd, "end", "");
+}
+
+std::string default_socket_path(){
+    if (const char* dir = std::getenv("XDG_RUNTIME_DIR"); dir && *dir) {
+        return std::string(dir) + "/atom.sock";
+    }
+    return "/tmp/atom-" + std::to_string(getuid()) + ".sock";
+}
+
+int serve(const std::string& socket_path){
+    const int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Error: socket: " << std::strerror(errno) << '\n';
+        return EXIT_FAILURE;
+    }
+    const sockaddr_un addr = socket_address(socket_path);
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        std::cerr << "Error: cannot listen on " << socket_path << ": " << std::strerror(errno) << '\n';
+        close(listen_fd);
+        return EXIT_FAILURE;
+    }
+
+    // no SA_RESTART, so a signal breaks accept() and the loop can clean up
+    struct sigaction action{};
+    action.sa_handler = handle_stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "atom: serving on " << socket_path << '\n';
+    const std::unique_ptr<CompileCache> cache = CompileCache::from_env();
+    CompileContext ctx;
+    ctx.cache = cache.get();
+    while (!g_stop) {
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: accept: " << std::strerror(errno) << '\n';
+            break;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &k_io_timeout, sizeof(k_io_timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &k_io_timeout, sizeof(k_io_timeout));
+        serve_connection(fd, ctx);
+        close(fd);
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    if (cache) cache->report(std::cerr);
+    return 0;
+}
+
+int client_compile(const std::string& socket_path, const std::string& input, const std::string& output,
+                   const CompileOptions& options, bool show_timing){
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const sockaddr_un addr = socket_address(socket_path);
+    if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0) {
+        std::cerr << "Error: no compile server on " << socket_path << ": " << std::strerror(errno) << '\n';
+        if (fd >= 0) close(fd);
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // the server runs elsewhere, so paths are made absolute and stdin is
+    // sent inline
+    bool sent = true;
+    if (input == "-") {
+        const SourceFile source(input);
+        sent = send_record(fd, "source", source.view());
+    } else {
+        sent = send_record(fd, "source_path", std::filesystem::absolute(input).string());
+    }
+    sent = sent && send_record(fd, "output", std::filesystem::absolute(output).string())
+                && send_record(fd, "stream", options.streaming ? "1" : "0")
+                && send_record(fd, "pipeline", options.pipelined ? "1" : "0")
+                && send_record(fd, "opt", std::to_string(options.opt_level))
+                && send_record(fd, "emit", options.emit == Emit::ir ? "ir" : options.emit == Emit::assembly ? "asm"
+                                                     : options.emit == Emit::bytecode ? "bc" : "bin")
+                && send_record(fd, "peephole", options.peephole ? "1" : "0")
+                && send_record(fd, "end", "");
+
+    std::string status;
+    std::string diagnostics;
+    std::string time_us;
+    while (sent) {
+        auto record = recv_record(fd);
+        if (!record || record->key == "end") break;
+        if (record->key == "status") status = std::move(record->value);
+        else if (record->key == "diagnostics") diagnostics = std::move(record->value);
+        else if (record->key == "time_us") time_us = std::move(record->value);
+    }
+    close(fd);
+
+    if (status.empty()) {
+        std::cerr << "Error: lost connection to compile server\n";
+        return EXIT_FAILURE;
+    }
+    if (!diagnostics.empty()) std::cerr << diagnostics << '\n';
+    if (show_timing) std::cerr << "atom: compiled by server in " << time_us << " us\n";
+    return status == "ok" ? 0 : EXIT_FAILURE;
+}
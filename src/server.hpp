@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include "driver.hpp"
+
+// Socket used when --socket is not given: $XDG_RUNTIME_DIR/atom.sock, or
+// /tmp/atom-<uid>.sock.
+std::string default_socket_path();
+
+// Runs the compile server on a Unix domain socket until SIGINT/SIGTERM.
+// Requests are served one at a time with a single warm CompileContext,
+// and through the cache in $ATOM_CACHE_DIR if that is set.
+int serve(const std::string& socket_path);
+
+// Sends one compile request to a running server and reports the result as
+// a normal compile would. input is a path or "-" for stdin; output is the
+// executable path (resolved against the caller's working directory).
+int client_compile(const std::string& socket_path, const std::string& input, const std::string& output,
+                   const CompileOptions& options, bool show_timing);
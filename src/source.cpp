@@ -0,0 +1,59 @@
+#include "source.hpp"
+#include "error.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceFile::SourceFile(const std::string& path){
+    const bool from_stdin = path == "-";
+    const int fd = from_stdin ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw CompileError("Error: cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            madvise(data, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+            m_data = static_cast<const char*>(data);
+            m_size = static_cast<size_t>(st.st_size);
+            m_mapped = true;
+        }
+    }
+    if (!m_mapped) {
+        try {
+            read_all(fd);
+        } catch (...) {
+            if (!from_stdin) close(fd);
+            throw;
+        }
+    }
+    if (!from_stdin) close(fd);
+}
+
+SourceFile::~SourceFile(){
+    if (m_mapped) munmap(const_cast<char*>(m_data), m_size);
+}
+
+void SourceFile::read_all(int fd){
+    size_t used = 0;
+    m_buffer.resize(64 * 1024);
+    while (true) {
+        if (used == m_buffer.size()) m_buffer.resize(m_buffer.size() * 2);
+        const ssize_t n = ::read(fd, m_buffer.data() + used, m_buffer.size() - used);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw CompileError(std::string("Error: read failed: ") + std::strerror(errno));
+        }
+        used += static_cast<size_t>(n);
+    }
+    m_buffer.resize(used);
+    m_data = m_buffer.data();
+    m_size = used;
+}
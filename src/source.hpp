@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Read-only view of an input program. Regular files are mmap'd; stdin
+// ("-") and pipes are read into an owned buffer.
+class SourceFile{
+public:
+    explicit SourceFile(const std::string& path);
+    ~SourceFile();
+
+    SourceFile(const SourceFile& other) = delete;
+    SourceFile& operator=(const SourceFile& other) = delete;
+
+    std::string_view view() const {
+        return {m_data, m_size};
+    }
+
+    bool mapped() const {
+        return m_mapped;
+    }
+private:
+    void read_all(int fd);
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::string m_buffer;
+};
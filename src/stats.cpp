@@ -0,0 +1,54 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <sys/resource.h>
+
+static constexpr const char* k_expr_names[] = {"int_lit", "ident", "add", "sub", "multi", "div", "eq"};
+static constexpr const char* k_stmt_names[] = {"exit", "let", "assign", "scope", "if"};
+static constexpr const char* k_pred_names[] = {"elif", "else"};
+
+void CompileStats::count_nodes(const Ast& ast){
+    for (const nodeExpr& expr : ast.exprs) exprs[static_cast<size_t>(expr.kind)]++;
+    for (const nodeStmt& stmt : ast.stmts) stmts[static_cast<size_t>(stmt.kind)]++;
+    for (const nodeIfPred& pred : ast.preds) preds[static_cast<size_t>(pred.kind)]++;
+    ast_peak_bytes = std::max<uint64_t>(ast_peak_bytes, ast.bytes());
+    ast_reserved_bytes = std::max<uint64_t>(ast_reserved_bytes, ast.reserved_bytes());
+}
+
+template <size_t N>
+static void report_kinds(std::ostream& out, const char* what, const std::array<uint64_t, N>& counts,
+                         const char* const (&names)[N]){
+    uint64_t total = 0;
+    for (const uint64_t count : counts) total += count;
+    out << std::left << std::setw(16) << what << std::right << std::setw(14) << total;
+    const char* sep = "  (";
+    for (size_t i = 0; i < N; ++i){
+        if (!counts[i]) continue;
+        out << sep << names[i] << ' ' << counts[i];
+        sep = ", ";
+    }
+    out << (total ? ")\n" : "\n");
+}
+
+void CompileStats::report(std::ostream& out) const {
+    const auto line = [&](const char* name, uint64_t value) {
+        out << std::left << std::setw(16) << name << std::right << std::setw(14) << value << '\n';
+    };
+    // nothing was compiled on a cache hit
+    if (tokens) {
+        line("tokens", tokens);
+        report_kinds(out, "expr nodes", exprs, k_expr_names);
+        report_kinds(out, "stmt nodes", stmts, k_stmt_names);
+        report_kinds(out, "elif/else nodes", preds, k_pred_names);
+        line("ast bytes used", ast_peak_bytes);
+        line("ast bytes wasted", ast_reserved_bytes - std::min(ast_peak_bytes, ast_reserved_bytes));
+    }
+    for (const auto& [name, bytes] : outputs){
+        out << std::left << std::setw(16) << "output bytes" << std::right << std::setw(14) << bytes << "  " << name << '\n';
+    }
+    rusage self{};
+    getrusage(RUSAGE_SELF, &self);
+    line("peak rss kb", static_cast<uint64_t>(self.ru_maxrss));
+    if (tool_peak_rss_kb) line("nasm/ld rss kb", static_cast<uint64_t>(tool_peak_rss_kb));
+}
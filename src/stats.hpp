@@ -0,0 +1,28 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ast.hpp"
+
+// What --stats reports next to the stage timings: how much a compile went
+// through and the memory it took.
+struct CompileStats{
+    uint64_t tokens = 0;
+    std::array<uint64_t, 7> exprs{};        // by ExprKind
+    std::array<uint64_t, 5> stmts{};        // by StmtKind
+    std::array<uint64_t, 2> preds{};        // by PredKind: the elif and else arms; ifs are statements
+    uint64_t ast_peak_bytes = 0;            // most node storage in use at once
+    uint64_t ast_reserved_bytes = 0;        // what the node pools hold
+    std::vector<std::pair<std::string, uint64_t>> outputs;     // name, bytes
+    long tool_peak_rss_kb = 0;              // of nasm and ld
+
+    // Counts the nodes in ast. Called on every batch of parsed nodes
+    // before they are released, and before -O folding adds its own.
+    void count_nodes(const Ast& ast);
+
+    void report(std::ostream& out) const;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "interner.hpp"
+
+// Scoped name -> Value map. Interned ids are dense, so the table is a plain
+// array indexed by SymbolId instead of a hash. Every declaration goes to an
+// undo log that remembers what it shadowed; leaving a scope replays the log
+// back to the scope's mark.
+template <typename Value>
+class SymbolTable{
+public:
+    // nullptr if the name is not visible
+    const Value* find(SymbolId id) const {
+        if (id >= m_bindings.size() || m_bindings[id] == k_unbound) return nullptr;
+        return &m_log[m_bindings[id]].value;
+    }
+
+    Value* find(SymbolId id){
+        return const_cast<Value*>(static_cast<const SymbolTable&>(*this).find(id));
+    }
+
+    // Binds id in the innermost scope, shadowing any outer binding.
+    Value& declare(SymbolId id, const Value& value){
+        if (id >= m_bindings.size()) m_bindings.resize(id + 1, k_unbound);
+        m_log.push_back({.id = id, .shadowed = m_bindings[id], .value = value});
+        m_bindings[id] = static_cast<uint32_t>(m_log.size() - 1);
+        return m_log.back().value;
+    }
+
+    void begin_scope(){
+        m_scopes.push_back(m_log.size());
+    }
+
+    // Unbinds everything declared since the matching begin_scope() and
+    // returns how many names that was.
+    size_t end_scope(){
+        const size_t mark = m_scopes.back();
+        m_scopes.pop_back();
+        const size_t count = m_log.size() - mark;
+        while (m_log.size() > mark){
+            m_bindings[m_log.back().id] = m_log.back().shadowed;
+            m_log.pop_back();
+        }
+        return count;
+    }
+
+    // number of live bindings across all scopes
+    size_t size() const {
+        return m_log.size();
+    }
+
+    void clear(){
+        m_bindings.clear();
+        m_log.clear();
+        m_scopes.clear();
+    }
+private:
+    static constexpr uint32_t k_unbound = UINT32_MAX;
+
+    struct Entry{
+        SymbolId id;
+        uint32_t shadowed;
+        Value value;
+    };
+
+    std::vector<uint32_t> m_bindings;   // SymbolId -> index into m_log
+    std::vector<Entry> m_log;
+    std::vector<size_t> m_scopes;
+};
@@ -0,0 +1,79 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t threads){
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; ++i) m_queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < threads; ++i) m_threads.emplace_back([this, i] { worker_loop(i); });
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_work_cv.notify_all();
+    for (std::thread& thread : m_threads) thread.join();
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t task, size_t worker)>& fn){
+    if (count == 0) return;
+    std::unique_lock lock(m_mutex);
+    m_fn = &fn;
+    m_pending = count;
+    m_generation++;
+    // deal tasks out round-robin; stealing evens out whatever is left
+    for (size_t task = 0; task < count; ++task) {
+        Queue& queue = *m_queues[task % m_queues.size()];
+        std::lock_guard queue_lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    m_work_cv.notify_all();
+    m_done_cv.wait(lock, [this] { return m_pending == 0; });
+    m_fn = nullptr;
+}
+
+bool ThreadPool::pop_local(size_t worker, size_t& task){
+    Queue& queue = *m_queues[worker];
+    std::lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(size_t worker, size_t& task){
+    for (size_t i = 1; i < m_queues.size(); ++i) {
+        Queue& queue = *m_queues[(worker + i) % m_queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(size_t worker){
+    size_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock lock(m_mutex);
+            m_work_cv.wait(lock, [&] { return m_stop || m_generation != seen_generation; });
+            if (m_stop) return;
+            seen_generation = m_generation;
+        }
+        size_t task;
+        while (pop_local(worker, task) || steal(worker, task)) {
+            // tasks are queued under m_mutex after m_fn is set, so this is
+            // the function of the run() the task belongs to
+            const std::function<void(size_t, size_t)>* fn;
+            {
+                std::lock_guard lock(m_mutex);
+                fn = m_fn;
+            }
+            (*fn)(task, worker);
+            std::lock_guard lock(m_mutex);
+            if (--m_pending == 0) m_done_cv.notify_all();
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers, each with its own task deque. A worker takes new
+// tasks from the back of its own deque and, once that is empty, steals
+// from the front of the others'.
+class ThreadPool{
+public:
+    explicit ThreadPool(size_t threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    size_t size() const {
+        return m_queues.size();
+    }
+
+    // Runs fn(task, worker) for every task in [0, count) and waits for all
+    // of them. fn must not throw.
+    void run(size_t count, const std::function<void(size_t task, size_t worker)>& fn);
+
+private:
+    struct Queue{
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    void worker_loop(size_t worker);
+    bool pop_local(size_t worker, size_t& task);
+    bool steal(size_t worker, size_t& task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_done_cv;
+    const std::function<void(size_t, size_t)>* m_fn = nullptr;
+    size_t m_pending = 0;
+    size_t m_generation = 0;
+    bool m_stop = false;
+};
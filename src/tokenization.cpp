@@ -1,4 +1,16 @@
 #include "tokenization.hpp"
+#include "error.hpp"
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ATOM_SIMD 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ATOM_SIMD 1
+#endif
 
 std::optional<int> bin_prec(TokenType type){
     switch(type){
@@ -55,130 +67,275 @@ std::string to_string(const TokenType type){
     }
 }
 
-struct Token;
+enum CharClass : uint8_t {
+    cc_other = 0,
+    cc_space = 1 << 0,
+    cc_alpha = 1 << 1,
+    cc_digit = 1 << 2,
+};
 
-Tokenizer::Tokenizer(std::string src) : m_src(std::move(src)){}
+static constexpr std::array<uint8_t, 256> make_char_classes(){
+    std::array<uint8_t, 256> table{};
+    for (int c = 'a'; c <= 'z'; ++c) table[c] = cc_alpha;
+    for (int c = 'A'; c <= 'Z'; ++c) table[c] = cc_alpha;
+    for (int c = '0'; c <= '9'; ++c) table[c] = cc_digit;
+    for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) table[c] = cc_space;
+    return table;
+}
 
-std::vector<Token> Tokenizer::tokenize(){
-    int line_count = 1;
-    std::string buf;
-    std::vector<Token> tokens;
-    while(peek().has_value()){
-        if(std::isalpha(peek().value())){
-            buf.push_back(consume());
-            while(peek().has_value() && std::isalnum(peek().value())){
-                buf.push_back(consume());
-            }
-            if (buf == "exit"){
-                tokens.push_back({.type = TokenType::_exit, .value = "exit", .line = line_count});
-                buf.clear();
-            }
-            else if (buf == "let"){
-                tokens.push_back({.type = TokenType::let, .value = "let", .line = line_count});
-                buf.clear();
-            }
-            else if (buf == "if"){
-                tokens.push_back({.type = TokenType::if_, .value = "if", .line = line_count});
-                buf.clear();
-            }
-            else if (buf == "elif"){
-                tokens.push_back({.type = TokenType::elif, .value = "elif", .line = line_count});
-                buf.clear();
-            }
-            else if (buf == "else"){
-                tokens.push_back({.type = TokenType::else_, .value = "else", .line = line_count});
-                buf.clear();
-            }
-            else {
-                tokens.push_back({.type = TokenType::ident, .value = buf, .line = line_count});
-                buf.clear();
-            }
-        }
-        else if (std::isdigit(peek().value())) {
-            buf.push_back(consume());
-            while(peek().has_value() && std::isdigit(peek().value()))
-                buf.push_back(consume());
-            tokens.push_back({.type = TokenType::int_lit, .value = buf, .line = line_count});
-            buf.clear();
-            continue;
-        }
-        // comments (one line)
-        else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/'){
-            consume();
-            consume();
-            while (peek().has_value() && peek().value() != '\n'){
-                consume();
-            }
-        }
-        // multi-line comments /* ................ */
-        else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*'){
-            consume();
-            consume();
-            while (peek().has_value()){
-                if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') break;
-                consume();
-            }
-            if (peek().has_value()) consume();
-            if (peek().has_value()) consume();
+static constexpr std::array<uint8_t, 256> k_char_class = make_char_classes();
+
+// Keywords are placed by (length + first + last char) & 7, which happens to be
+// collision free for the current set; a hit is confirmed with one compare.
+struct Keyword{
+    std::string_view text;
+    TokenType type;
+};
+
+static constexpr size_t keyword_slot(std::string_view word){
+    return (word.size() + static_cast<uint8_t>(word.front()) + static_cast<uint8_t>(word.back())) & 7;
+}
+
+static constexpr Keyword k_keyword_list[] = {
+    {"exit", TokenType::_exit},
+    {"let", TokenType::let},
+    {"if", TokenType::if_},
+    {"elif", TokenType::elif},
+    {"else", TokenType::else_},
+};
+
+static constexpr std::array<Keyword, 8> make_keyword_table(){
+    std::array<Keyword, 8> table{};
+    for (const Keyword& kw : k_keyword_list) table[keyword_slot(kw.text)] = kw;
+    return table;
+}
+
+static constexpr std::array<Keyword, 8> k_keywords = make_keyword_table();
+
+static constexpr bool keyword_table_complete(){
+    for (const Keyword& kw : k_keyword_list){
+        if (k_keywords[keyword_slot(kw.text)].text != kw.text) return false;
+    }
+    return true;
+}
+static_assert(keyword_table_complete(), "keyword hash has a collision");
+
+static TokenType keyword_or_ident(std::string_view word){
+    const Keyword& kw = k_keywords[keyword_slot(word)];
+    return kw.text == word ? kw.type : TokenType::ident;
+}
+
+#ifdef ATOM_SIMD
+#if defined(__AVX2__)
+using Vec = __m256i;
+static constexpr size_t k_vec_width = 32;
+static inline Vec load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+static inline Vec splat(char c) { return _mm256_set1_epi8(c); }
+static inline Vec cmp_eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Vec cmp_gt(Vec a, Vec b) { return _mm256_cmpgt_epi8(a, b); }
+static inline Vec vor(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+static inline Vec vand(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+static inline uint32_t bits(Vec v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+#else
+using Vec = __m128i;
+static constexpr size_t k_vec_width = 16;
+static inline Vec load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+static inline Vec splat(char c) { return _mm_set1_epi8(c); }
+static inline Vec cmp_eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline Vec cmp_gt(Vec a, Vec b) { return _mm_cmpgt_epi8(a, b); }
+static inline Vec vor(Vec a, Vec b) { return _mm_or_si128(a, b); }
+static inline Vec vand(Vec a, Vec b) { return _mm_and_si128(a, b); }
+static inline uint32_t bits(Vec v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+#endif
+
+static constexpr uint32_t k_all_lanes = k_vec_width == 32 ? 0xFFFFFFFFu : (1u << k_vec_width) - 1;
+
+// signed compares are fine here: every byte we look for is below 0x80
+static inline Vec in_range(Vec v, char lo, char hi){
+    return vand(cmp_gt(v, splat(static_cast<char>(lo - 1))), cmp_gt(splat(static_cast<char>(hi + 1)), v));
+}
+
+static inline uint32_t below(uint32_t mask, unsigned n){
+    return n >= 32 ? mask : mask & ((1u << n) - 1);
+}
+#endif
+
+static const char* skip_alnum(const char* p, const char* end){
+#ifdef ATOM_SIMD
+    while (static_cast<size_t>(end - p) >= k_vec_width){
+        const Vec v = load(p);
+        const Vec alpha = in_range(vor(v, splat(0x20)), 'a', 'z');
+        const uint32_t stop = ~bits(vor(alpha, in_range(v, '0', '9'))) & k_all_lanes;
+        if (stop) return p + std::countr_zero(stop);
+        p += k_vec_width;
+    }
+#endif
+    while (p < end && (k_char_class[static_cast<uint8_t>(*p)] & (cc_alpha | cc_digit))) ++p;
+    return p;
+}
+
+static const char* skip_digits(const char* p, const char* end){
+#ifdef ATOM_SIMD
+    while (static_cast<size_t>(end - p) >= k_vec_width){
+        const uint32_t stop = ~bits(in_range(load(p), '0', '9')) & k_all_lanes;
+        if (stop) return p + std::countr_zero(stop);
+        p += k_vec_width;
+    }
+#endif
+    while (p < end && (k_char_class[static_cast<uint8_t>(*p)] & cc_digit)) ++p;
+    return p;
+}
+
+static const char* skip_space(const char* p, const char* end, int& line){
+#ifdef ATOM_SIMD
+    while (static_cast<size_t>(end - p) >= k_vec_width){
+        const Vec v = load(p);
+        const uint32_t newlines = bits(cmp_eq(v, splat('\n')));
+        const uint32_t stop = ~bits(vor(cmp_eq(v, splat(' ')), in_range(v, '\t', '\r'))) & k_all_lanes;
+        if (stop) {
+            const unsigned n = std::countr_zero(stop);
+            line += std::popcount(below(newlines, n));
+            return p + n;
         }
-        else if (peek().value() == '('){
-            consume();
-            tokens.push_back({.type = TokenType::open_paren, .line = line_count});
+        line += std::popcount(newlines);
+        p += k_vec_width;
+    }
+#endif
+    for (; p < end && (k_char_class[static_cast<uint8_t>(*p)] & cc_space); ++p){
+        if (*p == '\n') line++;
+    }
+    return p;
+}
+
+static const char* skip_line_comment(const char* p, const char* end){
+    const void* nl = std::memchr(p, '\n', end - p);
+    return nl ? static_cast<const char*>(nl) : end;
+}
+
+// returns the position of the closing "*/", or end if the comment is unterminated
+static const char* find_comment_end(const char* p, const char* end, int& line){
+#ifdef ATOM_SIMD
+    while (static_cast<size_t>(end - p) > k_vec_width){
+        const Vec v = load(p);
+        const uint32_t newlines = bits(cmp_eq(v, splat('\n')));
+        const uint32_t close = bits(vand(cmp_eq(v, splat('*')), cmp_eq(load(p + 1), splat('/'))));
+        if (close) {
+            const unsigned n = std::countr_zero(close);
+            line += std::popcount(below(newlines, n));
+            return p + n;
         }
-        else if (peek().value() == ')'){
-            consume();
-            tokens.push_back({.type = TokenType::close_paren, .line = line_count});
+        line += std::popcount(newlines);
+        p += k_vec_width;
+    }
+#endif
+    for (; p < end; ++p){
+        if (*p == '*' && p + 1 < end && p[1] == '/') return p;
+        if (*p == '\n') line++;
+    }
+    return end;
+}
+
+static uint64_t decode_int(const char* p, const char* end, int line){
+    uint64_t value = 0;
+    // up to 19 decimal digits always fit into 64 bits
+    if (end - p < 20){
+        for (; p < end; ++p) value = value * 10 + static_cast<uint64_t>(*p - '0');
+        return value;
+    }
+    for (; p < end; ++p){
+        const uint64_t digit = static_cast<uint64_t>(*p - '0');
+        if (value > (UINT64_MAX - digit) / 10) {
+            throw CompileError("integer literal out of range on line " + std::to_string(line));
         }
-        else if (peek().value() == ';'){
-            consume();
-            tokens.push_back({.type = TokenType::semi, .line = line_count});
+        value = value * 10 + digit;
+    }
+    return value;
+}
+
+Tokenizer::Tokenizer(std::string_view src, Interner& interner)
+    : m_src(src), m_interner(interner), m_pos(src.data()){
+    if (m_src.size() > UINT32_MAX) {
+        throw CompileError("source file is too large");
+    }
+}
+
+std::vector<Token> Tokenizer::tokenize(){
+    std::vector<Token> tokens;
+    tokenize(tokens);
+    return tokens;
+}
+
+void Tokenizer::tokenize(std::vector<Token>& tokens){
+    // typical sources average more than three bytes per token; reserving up
+    // front avoids regrowing (and copying) the vector several times
+    tokens.reserve(tokens.size() + m_src.size() / 3 + 16);
+    Token batch[k_batch_size];
+    while (const size_t n = read(batch, k_batch_size)){
+        tokens.insert(tokens.end(), batch, batch + n);
+    }
+}
+
+size_t Tokenizer::read(Token* out, size_t max){
+    size_t count = 0;
+    int line_count = m_line;
+    const char* p = m_pos;
+    const char* const end = m_src.data() + m_src.size();
+    auto punct = [&](TokenType type, size_t len){
+        out[count++] = make_token(type, p, p + len, line_count);
+        p += len;
+    };
+    while (count < max){
+        p = skip_space(p, end, line_count);
+        if (p == end) break;
+        const char* const start = p;
+        const uint8_t cls = k_char_class[static_cast<uint8_t>(*p)];
+        if (cls & cc_alpha){
+            p = skip_alnum(p + 1, end);
+            const std::string_view word(start, p - start);
+            Token token = make_token(keyword_or_ident(word), start, p, line_count);
+            if (token.type == TokenType::ident) token.value = m_interner.intern(word);
+            out[count++] = token;
             continue;
         }
-        else if (peek().value() == '=' && peek(1).has_value() && peek(1).value() == '='){
-            consume();
-            consume();
-            tokens.push_back({.type = TokenType::eqeq, .line = line_count});
-        }
-        else if (peek().value() == '='){
-            consume();
-            tokens.push_back({.type = TokenType::eq, .line = line_count});
-        }
-        else if (peek().value() == '+'){
-            consume();
-            tokens.push_back({.type = TokenType::plus, .line = line_count});
-        }
-        else if (peek().value() == '*'){
-            consume();
-            tokens.push_back({.type = TokenType::star, .line = line_count});
-        }
-        else if (peek().value() == '-'){
-            consume();
-            tokens.push_back({.type = TokenType::minus, .line = line_count});
-        }
-        else if (peek().value() == '/'){
-            consume();
-            tokens.push_back({.type = TokenType::fslash, .line = line_count});
-        }
-        else if (peek().value() == '{'){
-            consume();
-            tokens.push_back({.type = TokenType::open_curly, .line = line_count});
-        }
-        else if (peek().value() == '}'){
-            consume();
-            tokens.push_back({.type = TokenType::close_curly, .line = line_count});
-        }
-        else if (peek().value() == '\n'){
-            consume();
-            line_count++;
-        }
-        else if (std::isspace(peek().value())){
-            consume();
+        if (cls & cc_digit){
+            p = skip_digits(p + 1, end);
+            Token token = make_token(TokenType::int_lit, start, p, line_count);
+            token.value = decode_int(start, p, line_count);
+            out[count++] = token;
+            continue;
         }
-        else {
-            std::cerr << "invalid token\n";
-            exit(EXIT_FAILURE);
+        const char next = p + 1 < end ? p[1] : '\0';
+        switch (*p){
+            case '/':
+                // comments (one line)
+                if (next == '/') {
+                    p = skip_line_comment(p + 2, end);
+                }
+                // multi-line comments /* ................ */
+                else if (next == '*') {
+                    p = find_comment_end(p + 2, end, line_count);
+                    p = p == end ? end : p + 2;
+                }
+                else punct(TokenType::fslash, 1);
+                break;
+            case '(': punct(TokenType::open_paren, 1); break;
+            case ')': punct(TokenType::close_paren, 1); break;
+            case ';': punct(TokenType::semi, 1); break;
+            case '=':
+                if (next == '=') punct(TokenType::eqeq, 2);
+                else punct(TokenType::eq, 1);
+                break;
+            case '+': punct(TokenType::plus, 1); break;
+            case '*': punct(TokenType::star, 1); break;
+            case '-': punct(TokenType::minus, 1); break;
+            case '{': punct(TokenType::open_curly, 1); break;
+            case '}': punct(TokenType::close_curly, 1); break;
+            default:
+                throw CompileError("invalid token");
         }
     }
-    m_index = 0;
-    return tokens;
-}
\ No newline at end of file
+    m_pos = p;
+    m_line = line_count;
+    m_count += count;
+    return count;
+}
@@ -1,10 +1,13 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <optional>
 #include <iostream>
+#include "interner.hpp"
 
-enum class TokenType{
+enum class TokenType : uint8_t {
     _exit,
     int_lit,
     semi,
@@ -29,25 +32,59 @@ std::optional<int> bin_prec(TokenType type);
 
 std::string to_string(const TokenType type);
 
+// Tokens do not own text: offset/length point into the source buffer.
+// value holds the decoded integer for int_lit and the SymbolId for ident.
 struct Token {
     TokenType type;
-    std::optional<std::string> value;
     int line;
+    uint32_t offset;
+    uint32_t length;
+    uint64_t value;
 };
 
-class Tokenizer{
+// Where a streaming Parser pulls its tokens from: the tokenizer itself,
+// or a ring that a tokenizer on another thread fills.
+class TokenSource{
     public:
-        explicit Tokenizer(std::string src);
+        virtual ~TokenSource() = default;
+
+        // Pulls up to max further tokens into out; returns 0 once the
+        // source is exhausted.
+        virtual size_t read(Token* out, size_t max) = 0;
+};
+
+class Tokenizer final : public TokenSource{
+    public:
+        Tokenizer(std::string_view src, Interner& interner);
 
         std::vector<Token> tokenize();
-    private:
-        std::optional<char> peek(int offset = 0) const {
-            if (m_index + offset >= m_src.length()) return {};
-            else return m_src[m_index + offset];
+
+        // Same as tokenize(), but appends to a caller-owned vector so its
+        // storage can be reused.
+        void tokenize(std::vector<Token>& tokens);
+
+        // A batch is always max tokens unless the source runs out, so the
+        // same calls cut the source into the same batches.
+        size_t read(Token* out, size_t max) override;
+
+        static constexpr size_t k_batch_size = 512;
+
+        // tokens read so far
+        size_t token_count() const {
+            return m_count;
         }
-        const std::string m_src; 
-        size_t m_index = 0;
-        char consume(){
-            return m_src.at(m_index++);
+
+        std::string_view lexeme(const Token& token) const {
+            return m_src.substr(token.offset, token.length);
+        }
+    private:
+        Token make_token(TokenType type, const char* start, const char* end, int line) const {
+            return {.type = type, .line = line, .offset = static_cast<uint32_t>(start - m_src.data()),
+                    .length = static_cast<uint32_t>(end - start), .value = 0};
         }
+        const std::string_view m_src;
+        Interner& m_interner;
+        const char* m_pos;
+        int m_line = 1;
+        size_t m_count = 0;
 };
\ No newline at end of file
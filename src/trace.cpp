@@ -0,0 +1,70 @@
+#include "trace.hpp"
+#include "output.hpp"
+#include <unistd.h>
+
+static int thread_id(){
+    static thread_local const int tid = static_cast<int>(gettid());
+    return tid;
+}
+
+void Trace::span(const char* name, Clock::time_point start, Clock::time_point end, std::string_view detail){
+    const int64_t from = std::chrono::duration_cast<std::chrono::nanoseconds>(start - m_origin).count();
+    const int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    const std::lock_guard lock(m_mutex);
+    m_events.push_back({name, std::string(detail), from, duration, thread_id()});
+}
+
+void Trace::name_thread(const char* name){
+    const std::lock_guard lock(m_mutex);
+    m_threads.emplace_back(thread_id(), name);
+}
+
+// microseconds, with the nanoseconds as decimals
+static void write_us(OutputBuffer& out, int64_t ns){
+    const int64_t frac = ns % 1000;
+    out << ns / 1000 << '.' << static_cast<char>('0' + frac / 100) << static_cast<char>('0' + frac / 10 % 10)
+        << static_cast<char>('0' + frac % 10);
+}
+
+static void write_string(OutputBuffer& out, std::string_view text){
+    out << '"';
+    for (const char c : text){
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) out << "\\u00" << static_cast<char>('0' + (c >> 4))
+                                                           << "0123456789abcdef"[c & 15];
+        else out << c;
+    }
+    out << '"';
+}
+
+void Trace::write(const std::string& path) const {
+    const std::lock_guard lock(m_mutex);
+    const int pid = static_cast<int>(getpid());
+    OutputBuffer out(path, false);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (const auto& [tid, name] : m_threads){
+        out << (first ? "" : ",\n") << R"({"ph": "M", "name": "thread_name", "pid": )" << pid << ", \"tid\": " << tid
+            << ", \"args\": {\"name\": ";
+        write_string(out, name);
+        out << "}}";
+        first = false;
+    }
+    for (const Event& event : m_events){
+        out << (first ? "" : ",\n") << R"({"ph": "X", "name": )";
+        write_string(out, event.name);
+        out << ", \"pid\": " << pid << ", \"tid\": " << event.tid << ", \"ts\": ";
+        write_us(out, event.start_ns);
+        out << ", \"dur\": ";
+        write_us(out, event.duration_ns);
+        if (!event.detail.empty()) {
+            out << ", \"args\": {\"detail\": ";
+            write_string(out, event.detail);
+            out << '}';
+        }
+        out << '}';
+        first = false;
+    }
+    out << "\n]}\n";
+    out.flush();
+}
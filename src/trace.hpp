@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Spans of time for --trace, written out in the Chrome trace-event format
+// (chrome://tracing, Perfetto). One trace is shared by every compile of the
+// process; a span remembers the thread it ran on, so parallel compiles and
+// the threads of a pipelined one each get a track of their own.
+class Trace{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Stages shorter than this are not worth a span: a streaming compile
+    // would otherwise leave several per statement. --stats still counts
+    // them.
+    static constexpr std::chrono::microseconds k_min_span{10};
+
+    void span(const char* name, Clock::time_point start, Clock::time_point end, std::string_view detail = {});
+
+    // labels the calling thread's track
+    void name_thread(const char* name);
+
+    // Throws CompileError if the file cannot be written.
+    void write(const std::string& path) const;
+private:
+    struct Event{
+        const char* name;
+        std::string detail;
+        int64_t start_ns;       // since m_origin
+        int64_t duration_ns;
+        int tid;
+    };
+
+    const Clock::time_point m_origin = Clock::now();
+    mutable std::mutex m_mutex;
+    std::vector<Event> m_events;
+    std::vector<std::pair<int, const char*>> m_threads;
+};
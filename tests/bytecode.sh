@@ -0,0 +1,88 @@
+#!/bin/sh
+# usage: bytecode.sh <atom>
+#
+# Damages the bytecode of test.at in the ways the loader must catch and
+# checks that --interp refuses each file with the right reason instead of
+# running it. Also checks that a division by zero still kills the
+# interpreter when SIGFPE was ignored by its parent.
+#
+# layout: a 24-byte header (magic, version, registers, constant count,
+# instruction count), 8 bytes per constant, 16 bytes per instruction
+# (opcode, 3 unused, dst, a, b)
+
+atom=$(realpath "$1")
+root=$(dirname "$(realpath "$0")")/..
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 2
+
+"$atom" --emit=bc "$root/test.at" || exit 1
+"$atom" --interp out.bc
+[ $? = 24 ] || { echo "FAIL: the undamaged file does not run"; exit 1; }
+
+size=$(wc -c < out.bc)
+constants=$(od -An -tu4 -j12 -N4 out.bc | tr -d ' ')
+code=$((24 + 8 * constants))
+last=$((size - 16))
+
+# patch <file> <offset> <printf bytes>
+patch(){
+    printf "$3" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+failed=0
+# expect <file> <reason>
+expect(){
+    message=$("$atom" --interp "$1" 2>&1)
+    status=$?
+    case $message in
+        *"$2"*) [ $status = 1 ] && return ;;
+    esac
+    echo "FAIL $1: exit $status, \"$message\", expected \"$2\""
+    failed=$((failed + 1))
+}
+
+: > empty.bc
+expect empty.bc "too short"
+head -c 20 out.bc > header.bc
+expect header.bc "too short"
+head -c $((size - 1)) out.bc > truncated.bc
+expect truncated.bc "bad size"
+{ cat out.bc; printf 'x'; } > trailing.bc
+expect trailing.bc "bad size"
+
+cp out.bc magic.bc; patch magic.bc 0 'X'
+expect magic.bc "bad magic"
+cp out.bc version.bc; patch version.bc 4 '\377'
+expect version.bc "unsupported version"
+cp out.bc registers.bc; patch registers.bc 8 '\0\0\0\0'
+expect registers.bc "bad register count"
+# 32 GiB of registers that no instruction names
+cp out.bc huge.bc; patch huge.bc 8 '\377\377\377\377'
+expect huge.bc "bad register count"
+
+cp out.bc opcode.bc; patch opcode.bc $code '\377'
+expect opcode.bc "bad opcode"
+cp out.bc operand.bc; patch operand.bc $((last + 8)) '\377\377\377\377'
+expect operand.bc "bad register"
+# the final exit becomes a jump out of the program
+cp out.bc jump.bc; patch jump.bc $last '\6'; patch jump.bc $((last + 4)) '\377\377\377\377'
+expect jump.bc "bad jump target"
+# the first instruction jumping to itself, which would never end
+cp out.bc loop.bc; patch loop.bc $code '\6'; patch loop.bc $((code + 4)) '\0\0\0\0'
+expect loop.bc "bad jump target"
+# ... or a mov, after which execution would run off the end
+cp out.bc end.bc; patch end.bc $last '\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0'
+expect end.bc "falls off the end"
+
+expect missing.bc "cannot open"
+
+status=$( (trap '' FPE; "$atom" --interp "$root/tests/corpus/div_zero.at"; echo $?) 2>/dev/null)
+if [ $status != 136 ]; then
+    echo "FAIL: division by zero with SIGFPE ignored: exit $status, expected 136"
+    failed=$((failed + 1))
+fi
+
+[ $failed = 0 ] && echo "bytecode: all damaged files rejected"
+[ $failed = 0 ]
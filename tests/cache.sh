@@ -0,0 +1,76 @@
+#!/bin/sh
+# usage: cache.sh <atom>
+#
+# Compiles with ATOM_CACHE_DIR set and checks from --cache-stats which
+# compiles hit the cache, and that what a hit puts in place still runs.
+
+atom=$(realpath "$1")
+root=$(dirname "$(realpath "$0")")/..
+
+work=$(mktemp -d)
+trap 'chmod -R u+w "$work"; rm -rf "$work"' EXIT
+cd "$work" || exit 2
+export ATOM_CACHE_DIR="$work/cache"
+
+cp "$root/test.at" a.at
+printf 'let a = 40;\nexit(a + 2);\n' > b.at
+
+failed=0
+# compile <hits> <misses> <atom arguments...>
+compile(){
+    expected="cache: $1 hits, $2 misses"
+    shift 2
+    stats=$("$atom" --cache-stats "$@" 2>&1)
+    case $stats in
+        "$expected"*) return ;;
+    esac
+    echo "FAIL atom $*: \"$stats\", expected \"$expected\""
+    failed=$((failed + 1))
+}
+
+# check <program> <exit code>
+check(){
+    "$@"
+    status=$?
+    [ $status = 24 ] && return
+    echo "FAIL $1: exit $status, expected 24"
+    failed=$((failed + 1))
+}
+
+compile 0 1 a.at
+check ./out
+compile 1 0 a.at
+check ./out
+
+# other options or another source are other entries
+compile 0 1 -O a.at
+compile 0 1 --emit=asm a.at
+compile 0 1 --emit=bc a.at
+compile 0 1 b.at
+./out
+[ $? = 42 ] || { echo "FAIL: b.at"; failed=$((failed + 1)); }
+
+# out is hard-linked into the cache: compiling b.at over it must not have
+# changed the entry of a.at
+compile 1 0 a.at
+check ./out
+compile 1 0 --emit=asm a.at
+check ./out
+[ -s out.asm ] || { echo "FAIL: no out.asm from the cache"; failed=$((failed + 1)); }
+compile 1 0 --emit=bc a.at
+check "$atom" --interp out.bc
+
+# an edit is a miss
+printf '\n' >> a.at
+compile 0 1 a.at
+check ./out
+
+# batch compiles share the cache
+printf 'exit(24);\n' > c.at
+printf 'exit(25);\n' > d.at
+compile 0 2 -j 2 -o bin c.at d.at
+compile 2 0 -j 2 -o bin c.at d.at
+check bin/c
+
+[ $failed = 0 ] && echo "cache: hits and misses as expected"
+[ $failed = 0 ]
@@ -0,0 +1,77 @@
+#!/bin/sh
+# usage: corpus.sh <atom> <mode>
+#
+# Compiles test.at and every tests/corpus/*.at in one mode and checks the
+# exit code of the program against the first line of the file:
+# "// exit <code>" (136 for a division by zero, which dies of SIGFPE) or
+# "// error" for a program the compiler must reject without leaving an
+# executable behind.
+#
+# modes: native, asm (nasm and ld), opt (-O), stream, pipeline, run (JIT),
+# interp, bc (--emit=bc, then --interp on the file)
+
+atom=$(realpath "$1")
+mode=$2
+root=$(dirname "$(realpath "$0")")/..
+
+case $mode in
+    native) flags= ;;
+    asm) flags=--emit=asm ;;
+    opt) flags=-O ;;
+    stream) flags=--stream ;;
+    pipeline) flags=--pipeline ;;
+    run|interp|bc) flags= ;;
+    *) echo "unknown mode: $mode" >&2; exit 2 ;;
+esac
+if [ "$mode" = asm ] && ! command -v nasm >/dev/null; then
+    echo "nasm not found, skipping"
+    exit 77
+fi
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 2
+
+# prints the exit code of the compiled program, or "error" if atom
+# rejected it
+run_case(){
+    case $mode in
+        run|interp)
+            "$atom" --$mode "$1" 2>/dev/null
+            code=$?
+            # atom's own failure, as opposed to a program exiting with 1
+            if [ $code = 1 ] && ! "$atom" --emit=ir "$1" 2>/dev/null; then code=error; fi
+            echo $code
+            return ;;
+        bc)
+            "$atom" --emit=bc "$1" 2>/dev/null || { echo error; return; }
+            "$atom" --interp out.bc 2>/dev/null
+            echo $?
+            return ;;
+    esac
+    if ! "$atom" $flags "$1" 2>/dev/null; then
+        [ -e out ] && echo "leftover out" || echo error
+        return
+    fi
+    ./out 2>/dev/null
+    echo $?
+}
+
+failed=0
+total=0
+for file in "$root/test.at" "$root"/tests/corpus/*.at; do
+    if [ "$file" = "$root/test.at" ]; then
+        expected=24
+    else
+        expected=$(head -n 1 "$file" | sed -n 's|^// exit \([0-9]*\).*|\1|p; s|^// error.*|error|p')
+    fi
+    rm -f out out.asm out.o out.bc
+    got=$(run_case "$file" 2>/dev/null)
+    total=$((total + 1))
+    if [ "$got" != "$expected" ]; then
+        echo "FAIL $(basename "$file") [$mode]: got $got, expected $expected"
+        failed=$((failed + 1))
+    fi
+done
+echo "$mode: $((total - failed))/$total passed"
+[ $failed = 0 ]